@@ -1,5 +1,6 @@
 #include <fstream>
 #include <iostream>
+#include <cmath>
 #include "utils.h"
 
 
@@ -20,6 +21,12 @@ public:
     std::vector<std::string> cell_tags {"date", "pos", "gl", "id"};
     std::vector<std::string> parent_tags {"date", "pos", "gl", "parent_id"};
 
+    // Row selection applied while reading (see getData)
+    std::vector<std::string> filters;
+    double time_min = -HUGE_VAL;
+    double time_max = HUGE_VAL;
+    int min_points = 0;
+
     CSVconfig(std::string filename) {
         std::ifstream fin(filename);
         // fin.open(filename);
@@ -70,6 +77,19 @@ public:
                         parent_tags.push_back(trim(val_split[i]));
                     }
                 }
+                else if (parts[0] == "filter"){
+                    // the expression itself may contain '=', thus take everything behind the first one
+                    filters.push_back(trim(line.substr(line.find("=")+1)));
+                }
+                else if (parts[0] == "time_min"){
+                    time_min = std::stod(parts[1]);
+                }
+                else if (parts[0] == "time_max"){
+                    time_max = std::stod(parts[1]);
+                }
+                else if (parts[0] == "min_points"){
+                    min_points = std::stoi(parts[1]);
+                }
             }
         }
     }
@@ -98,5 +118,14 @@ std::ostream& operator<<(std::ostream& os, const CSVconfig& config){
         os << config.parent_tags[i] << ' ';
     }
     os << "\n";
+    for(size_t i=0; i < config.filters.size(); i++){
+        os << pad_str("filter:", col) << config.filters[i] << "\n";
+    }
+    if (config.time_min > -HUGE_VAL)
+        os << pad_str("time_min:", col) << config.time_min << "\n";
+    if (config.time_max < HUGE_VAL)
+        os << pad_str("time_max:", col) << config.time_max << "\n";
+    if (config.min_points > 0)
+        os << pad_str("min_points:", col) << config.min_points << "\n";
     return os;
 }
\ No newline at end of file
@@ -17,6 +17,8 @@ All of which contain an initial (double) and a name (string).
 Non-fixed parameters have a step.
 
 Bound parameters have upper/lower (double) which are the respective bounds
+
+Positive parameters (variances and rates) are log transformed by the minimizer if they are free
 */
 public:
     bool fixed = false;
@@ -35,6 +37,7 @@ public:
 
     double err;
     std::string name;
+    bool positive = false;
 
     void set_paramter(std::vector<std::string> parts){
         name = parts[0];
@@ -156,6 +159,11 @@ public:
                 }
             }
         }
+        // variances and rates
+        mean_lambda.positive = gamma_lambda.positive = var_lambda.positive = true;
+        gamma_q.positive = var_q.positive = beta.positive = true;
+        var_x.positive = var_g.positive = var_dx.positive = var_dg.positive = true;
+
         // create vector containing all paramters in well-defined order
         all = {mean_lambda, gamma_lambda, var_lambda, mean_q, gamma_q, var_q, beta, var_x, var_g, var_dx, var_dg};
     }
@@ -0,0 +1,319 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <zlib.h>
+#include <zstd.h>
+
+#ifndef INPUT_STREAM_H
+#define INPUT_STREAM_H
+
+// ============================================================================= //
+// INPUT STREAM
+// ============================================================================= //
+
+std::string detect_compression(std::string filename, const unsigned char *magic, size_t n){
+    /*
+    * returns "gzip", "zstd" or "none", decided by the magic bytes at the beginning
+    * of the file or (if there are not enough bytes) by the file extension
+    */
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return "gzip";
+    if (n >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        return "zstd";
+    if (n < 4){
+        if (filename.size() > 3 && filename.substr(filename.size()-3) == ".gz")
+            return "gzip";
+        if (filename.size() > 4 && filename.substr(filename.size()-4) == ".zst")
+            return "zstd";
+    }
+    return "none";
+}
+
+
+class Input_streambuf : public std::streambuf{
+    /*
+    * Stream buffer that reads (and if needed decompresses) a file on a separate thread.
+    * The decompressed data is handed over in chunks via a bounded queue, such that reading
+    * and decompressing overlaps with the parsing of the lines on the calling thread.
+    * Compression (gzip or zstd) is detected via the magic bytes, no temporary files are written.
+    * The filename "-" reads from stdin, named pipes can be read like files. The data is read 
+    * with the posix read, which returns as soon as any data is available, such that rows from 
+    * a pipe are parsed as they arrive.
+    */
+public:
+    std::string compression = "none";
+    std::string error;  // set by the reading thread, complete once the end of the stream is reached
+
+    Input_streambuf(std::string filename){
+        if (filename == "-"){
+            fd = STDIN_FILENO;
+        } else {
+            fd = ::open(filename.c_str(), O_RDONLY);
+        }
+        if (fd < 0){
+            error = "could not open " + filename;
+            done = true;
+            return;
+        }
+        // sniff the magic bytes, those are the first bytes passed to the decoder
+        prefix.resize(4);
+        size_t n = 0;
+        while (n < prefix.size()){
+            ssize_t r = ::read(fd, prefix.data() + n, prefix.size() - n);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                break;
+            n += r;
+        }
+        prefix.resize(n);
+        if (::pipe(wake) != 0){
+            error = std::string("pipe failed: ") + std::strerror(errno);
+            done = true;
+            return;
+        }
+        compression = detect_compression(filename, (const unsigned char *) prefix.data(), prefix.size());
+
+        producer = std::thread(&Input_streambuf::produce, this);
+    }
+
+    ~Input_streambuf(){
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stop = true;
+        }
+        cv.notify_all();
+        // wakes the reading thread if it waits for data (e.g. on an idle pipe or stdin)
+        if (wake[1] >= 0 && ::write(wake[1], "x", 1) < 0)
+            std::cerr << "(Input_streambuf) Error: could not stop the reading thread" << std::endl;
+        if (producer.joinable())
+            producer.join();
+        if (fd > STDIN_FILENO)
+            ::close(fd);
+        for (int i=0; i<2; ++i)
+            if (wake[i] >= 0)
+                ::close(wake[i]);
+    }
+
+protected:
+    int underflow() override{
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [this]{ return !chunks.empty() || done; });
+        if (chunks.empty())
+            return traits_type::eof();
+        current.swap(chunks.front());
+        chunks.pop_front();
+        lock.unlock();
+        cv.notify_all();
+
+        setg(current.data(), current.data(), current.data() + current.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    int fd = -1;
+    int wake[2] = {-1, -1};  // pipe, written by the destructor to interrupt a waiting read
+    std::vector<char> prefix;
+    std::thread producer;
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::vector<char>> chunks;
+    std::vector<char> current;
+    bool done = false;
+    bool stop = false;
+
+    static constexpr size_t chunk_size = 1 << 20;
+    static constexpr size_t max_chunks = 8;
+
+    size_t read_raw(std::vector<char> &buffer){
+        /* reads the next (available) block of the file, starting with the sniffed prefix */
+        size_t n = prefix.size();
+        if (n){
+            std::memcpy(buffer.data(), prefix.data(), n);
+            prefix.clear();
+            return n;
+        }
+        // wait for data or for the destructor
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {wake[0], POLLIN, 0}};
+        while (::poll(fds, 2, -1) < 0){
+            if (errno != EINTR){
+                error = std::string("poll failed: ") + std::strerror(errno);
+                return 0;
+            }
+        }
+        if (fds[1].revents)
+            return 0;
+        ssize_t r;
+        do {
+            r = ::read(fd, buffer.data(), buffer.size());
+        } while (r < 0 && errno == EINTR);
+        if (r < 0){
+            error = std::string("read failed: ") + std::strerror(errno);
+            return 0;
+        }
+        return r;
+    }
+
+    bool push(std::vector<char> &chunk){
+        /* hands a chunk over to the parsing thread, blocks if the queue is full */
+        if (chunk.empty())
+            return !stop;
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [this]{ return chunks.size() < max_chunks || stop; });
+        if (stop)
+            return false;
+        chunks.push_back(std::move(chunk));
+        lock.unlock();
+        cv.notify_all();
+        chunk = std::vector<char>();
+        return true;
+    }
+
+    void produce(){
+        if (compression == "gzip")
+            produce_gzip();
+        else if (compression == "zstd")
+            produce_zstd();
+        else
+            produce_plain();
+
+        {
+            std::lock_guard<std::mutex> lock(m);
+            done = true;
+        }
+        cv.notify_all();
+    }
+
+    void produce_plain(){
+        std::vector<char> buffer(chunk_size);
+        size_t n;
+        while ((n = read_raw(buffer)) > 0){
+            buffer.resize(n);
+            if (!push(buffer))
+                return;
+            buffer.resize(chunk_size);
+        }
+    }
+
+    void produce_gzip(){
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        // 15 + 32: maximal window size and automatic gzip/zlib header detection
+        if (inflateInit2(&zs, 15 + 32) != Z_OK){
+            error = "inflateInit2 failed";
+            return;
+        }
+        std::vector<char> in(chunk_size);
+        std::vector<char> out;
+        int ret = Z_OK;
+        size_t n;
+        while ((n = read_raw(in)) > 0){
+            zs.next_in = (Bytef *) in.data();
+            zs.avail_in = n;
+            // a full output buffer can mean that inflate has more output pending
+            do {
+                if (ret == Z_STREAM_END && zs.avail_in > 0)
+                    inflateReset(&zs); // concatenated gzip members
+                out.resize(chunk_size);
+                zs.next_out = (Bytef *) out.data();
+                zs.avail_out = out.size();
+                ret = inflate(&zs, Z_NO_FLUSH);
+                if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR){
+                    error = std::string("gzip decoding failed: ") + (zs.msg ? zs.msg : "unknown error");
+                    inflateEnd(&zs);
+                    return;
+                }
+                out.resize(out.size() - zs.avail_out);
+                if (ret == Z_BUF_ERROR && out.empty() && zs.avail_in > 0){
+                    error = "gzip decoding failed: no progress possible";
+                    inflateEnd(&zs);
+                    return;
+                }
+                if (!push(out)){
+                    inflateEnd(&zs);
+                    return;
+                }
+            } while (zs.avail_in > 0 || (zs.avail_out == 0 && ret != Z_STREAM_END));
+        }
+        if (ret != Z_STREAM_END)
+            error = "unexpected end of gzip stream (truncated file?)";
+        inflateEnd(&zs);
+    }
+
+    void produce_zstd(){
+        ZSTD_DStream *zds = ZSTD_createDStream();
+        ZSTD_initDStream(zds);
+        std::vector<char> in(ZSTD_DStreamInSize());
+        std::vector<char> out;
+        size_t n;
+        size_t ret = 0;
+        while ((n = read_raw(in)) > 0){
+            ZSTD_inBuffer input = {in.data(), n, 0};
+            bool output_full;
+            do {
+                out.resize(std::max(chunk_size, ZSTD_DStreamOutSize()));
+                ZSTD_outBuffer output = {out.data(), out.size(), 0};
+                ret = ZSTD_decompressStream(zds, &output, &input);
+                if (ZSTD_isError(ret)){
+                    error = std::string("zstd decoding failed: ") + ZSTD_getErrorName(ret);
+                    ZSTD_freeDStream(zds);
+                    return;
+                }
+                output_full = output.pos == output.size;
+                out.resize(output.pos);
+                if (!push(out)){
+                    ZSTD_freeDStream(zds);
+                    return;
+                }
+            } while (input.pos < input.size || output_full);
+        }
+        // a non-zero return value means that the last frame is incomplete
+        if (ret != 0)
+            error = "unexpected end of zstd stream (truncated file?)";
+        ZSTD_freeDStream(zds);
+    }
+};
+
+
+class Input_stream : public std::istream{
+    /*
+    * std::istream reading from a (possibly gzip or zstd compressed) file,
+    * usable with getline like an std::ifstream. A failed read or decoding (e.g. a truncated
+    * file) ends the stream early, check error() once the end is reached
+    */
+public:
+    Input_stream(std::string filename) : std::istream(nullptr), buffer(filename){
+        rdbuf(&buffer);
+        if (!buffer.error.empty())
+            setstate(std::ios_base::failbit);
+    }
+
+    std::string compression() const{
+        return buffer.compression;
+    }
+
+    std::string error() const{
+        /* error of the reading thread, empty if the file was read completely */
+        return buffer.error;
+    }
+
+private:
+    Input_streambuf buffer;
+};
+
+#endif
@@ -1,10 +1,16 @@
 #include "predictions.h"
+#include "likelihood_cache.h"
 
 #define _USE_MATH_DEFINES
 
 int _iteration = 0;
 int _print_level;
 std::string _outfile_ll;
+// evaluations of total_likelihood (capacity set with --cache-size) and the optional persistent cache (--disk-cache)
+Likelihood_cache _likelihood_cache;
+Likelihood_disk_cache _likelihood_disk_cache;
+// identifies the likelihood in the persistent cache, to be changed whenever the likelihood (or init_cells) changes
+const std::string _likelihood_model_version = "1";
 
 
 Eigen::MatrixXd rowwise_add(Eigen::MatrixXd m, Eigen::VectorXd v){
@@ -20,7 +26,7 @@ Eigen::MatrixXd rowwise_add(Eigen::MatrixXd m, Eigen::VectorXd v){
     return m_new;
 }
 
-double log_likelihood(Eigen::MatrixXd xgt, MOMAdata &cell, Eigen::MatrixXd S, Eigen::MatrixXd Si){
+double log_likelihood(Eigen::MatrixXd xgt, const MOMAdata &cell, Eigen::MatrixXd S, Eigen::MatrixXd Si){
     // tested (i.e. same output as python functions)
     /*
     * log likelihood
@@ -32,19 +38,23 @@ double log_likelihood(Eigen::MatrixXd xgt, MOMAdata &cell, Eigen::MatrixXd S, Ei
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
 void sc_likelihood(const std::vector<double> &params_vec, 
-                    MOMAdata &cell, 
+                    const MOMAdata &cell, 
+                    Eigen::VectorXd &mean, Eigen::MatrixXd &cov,
                     double &tl){
 /* Calculates the likelihood of a single cell (can be a root cell)
 * the params_vec contains paramters in the following (well defined) order:
 * {mean_lambda, gamma_lambda, var_lambda, mean_q, gamma_q, var_q, beta, var_x, var_g, var_dx, var_dg}
+* mean/cov hold the state at the end of the parent cell (not used for root cells) and are updated to the 
+* state at the end of the cell, the cell itself is not modified such that the likelihood can be 
+* calculated concurrently (e.g. for different parameters)
 */
     if (cell.is_root()){
-        cell.mean = cell.mean_init;
-        cell.cov = cell.cov_init;
+        mean = cell.mean_init;
+        cov = cell.cov_init;
     }
     else{
         // mean/cov is calculated from mother cell, does not depend on mean/cov of cell itself
-        mean_cov_after_division(cell, params_vec[9], params_vec[10]);
+        mean_cov_after_division(mean, cov, mean, cov, params_vec[9], params_vec[10]);
     }
 
     Eigen::VectorXd xg(2);
@@ -56,17 +66,17 @@ void sc_likelihood(const std::vector<double> &params_vec,
     Eigen::Matrix2d Si;
 
     for (size_t t=0; t<cell.time.size(); ++t ){
-        xg(0) = cell.log_length(t) - cell.mean(0);
-        xg(1) = cell.fp(t)         - cell.mean(1);
+        xg(0) = cell.log_length(t) - mean(0);
+        xg(1) = cell.fp(t)         - mean(1);
 
-        S = cell.cov.block(0,0,2,2) + D;
+        S = cov.block(0,0,2,2) + D;
         Si = S.inverse();
 
         tl += log_likelihood(xg, cell, S, Si); // add to total_likelihood of entire tree     
-        posterior(xg, cell, S, Si); // updates mean/cov        
+        posterior(xg, mean, cov, S, Si); // updates mean/cov        
 
         if (t<cell.time.size()-1) {
-            mean_cov_model(cell, cell.time(t+1)-cell.time(t) , params_vec[0], 
+            mean_cov_model(mean, cov, cell.time(t+1)-cell.time(t) , params_vec[0], 
                         params_vec[1], params_vec[2], params_vec[3], 
                         params_vec[4], params_vec[5], params_vec[6]); // updates mean/cov
         }
@@ -76,73 +86,153 @@ void sc_likelihood(const std::vector<double> &params_vec,
     }
 }
 
+void sc_likelihood(const std::vector<double> &params_vec, 
+                    MOMAdata &cell, 
+                    double &tl){
+    /* as above, using and updating the (forward) state of the cell and its parent */
+    if (!cell.is_root()){
+        cell.mean = cell.parent->mean;
+        cell.cov = cell.parent->cov;
+    }
+    sc_likelihood(params_vec, cell, cell.mean, cell.cov, tl);
+}
+
 
 /* --------------------------------------------------------------------------
 * liklihood wrapping
 * -------------------------------------------------------------------------- */
 
 void likelihood_recr(const std::vector<double> &params_vec, 
-                    MOMAdata *cell, 
+                    const MOMAdata *cell, 
+                    const Eigen::VectorXd &parent_mean, const Eigen::MatrixXd &parent_cov,
                     double &tl){
     /*  
-    * Recursive implementation that applies the function func to every cell in the genealogy
+    * Recursive implementation that applies the function func to every cell in the genealogy,
+    * the state at the end of each cell is passed to its daughters
     * not meant to be called directly, see wrapper below
     */
     if (cell == nullptr)
         return;
-    sc_likelihood(params_vec, *cell, tl);
-    likelihood_recr(params_vec, cell->daughter1, tl);
-    likelihood_recr(params_vec, cell->daughter2, tl);
+    Eigen::VectorXd mean = parent_mean;
+    Eigen::MatrixXd cov = parent_cov;
+    sc_likelihood(params_vec, *cell, mean, cov, tl);
+    likelihood_recr(params_vec, cell->daughter1, mean, cov, tl);
+    likelihood_recr(params_vec, cell->daughter2, mean, cov, tl);
 }
 
 
+double trees_likelihood(const std::vector<double> &params_vec, const std::vector<MOMAdata*> &cells){
+    /*
+    * sum of the log likelihoods of the cell trees starting at the root cells in cells,
+    * does not modify the cells (thread-safe)
+    */
+    double tl = 0;
+    for(size_t i=0; i < cells.size(); ++i){
+        if (cells[i]->is_root() ){
+            likelihood_recr(params_vec,  cells[i], cells[i]->mean_init, cells[i]->cov_init, tl);
+        }
+    }
+    return tl;
+}
+
+
+struct Likelihood_data{
+    /*
+    * cells and log of the likelihood evaluations that is passed (as void pointer) to total_likelihood,
+    * each concurrent minimization (e.g. multistart) has its own
+    */
+    std::vector<MOMAdata*> roots;
+    // every evaluation is appended to outfile (if set) and counted
+    std::string outfile;
+    int iteration = 0;
+    // prepended to the printed evaluations (print_level>0)
+    std::string label;
+    // only evaluations of the full data are cached (not of thinned data or subsets)
+    bool cache = true;
+    // the likelihood of the roots is multiplied by scale, e.g. to the scale of all data for a batch of roots
+    double scale = 1;
+    // evaluations with the same data can run concurrently (e.g. a batch of the Bayesian optimization), the log is locked
+    std::mutex mutex;
+
+    Likelihood_data(std::vector<MOMAdata*> roots, std::string outfile="", std::string label="") : 
+        roots(roots), outfile(outfile), label(label) {}
+};
+
+
 double total_likelihood(const std::vector<double> &params_vec, std::vector<double> &grad, void *c){
     /*
     * total_likelihood of cell trees, to be maximized
     */
 
-    double tl = 0;
-
-    // type cast the void vector back to vector of MOMAdata pointers
-    std::vector<MOMAdata*> cells = *(std::vector<MOMAdata*> *) c;
+    // type cast the void pointer back to the cells and log 
+    Likelihood_data *data = (Likelihood_data *) c;
 
-    for(size_t i=0; i < cells.size(); ++i){
-        if (cells[i]->is_root() ){
-            likelihood_recr(params_vec,  cells[i] , tl);
+    double tl;
+    if (!data->cache){
+        tl = data->scale * trees_likelihood(params_vec, data->roots);
+    }
+    else if (!_likelihood_cache.lookup(params_vec, tl)){
+        if (!_likelihood_disk_cache.lookup(params_vec, tl)){
+            tl = trees_likelihood(params_vec, data->roots);
+            _likelihood_disk_cache.insert(params_vec, tl);
         }
+        _likelihood_cache.insert(params_vec, tl);
     }
-    ++ _iteration;
+    std::lock_guard<std::mutex> lock(data->mutex);
+    ++ data->iteration;
 
     /* Save state of iteration in outfile */
-    std::ofstream file(_outfile_ll, std::ios_base::app);
+    if (data->outfile.size()){
+        std::ofstream file(data->outfile, std::ios_base::app);
 
-    file << _iteration << ",";
-    for (size_t i=0; i<params_vec.size(); ++i){
-        file << params_vec[i]  << ",";
+        file << data->iteration << ",";
+        for (size_t i=0; i<params_vec.size(); ++i){
+            file << params_vec[i]  << ",";
+        }
+        file << std::setprecision(10) << tl  << "\n";
+        file.close();
     }
-    file << std::setprecision(10) << tl  << "\n";
-    file.close();
 
     /* Print output dependend on set _print_level */
     if (_print_level>0){
-        if (_print_level==0)
-            std::cout << _iteration << ": " << tl << "\n";
-        if (_print_level>0){
-            std::cout << _iteration << ": ";
-                for (size_t i=0; i<params_vec.size(); ++i){
-                    std::cout << params_vec[i]  << ", ";
-                }
-                std::cout << "ll=" << tl  << "\n";
+        std::stringstream out;
+        out << data->label << data->iteration << ": ";
+        for (size_t i=0; i<params_vec.size(); ++i){
+            out << params_vec[i]  << ", ";
         }
+        out << "ll=" << tl  << "\n";
+        std::cout << out.str();
     }
 
     return -tl;
 }
 
 double total_likelihood(const std::vector<double> &params_vec, std::vector<MOMAdata> &cells){
+    /* likelihood evaluation logged to the global output file */
     std::vector<double> g;
+    Likelihood_data data(get_roots(cells), _outfile_ll);
+    data.iteration = _iteration;
+    double l = total_likelihood(params_vec, g, &data);
+    _iteration = data.iteration;
+    return l;
+}
+
+void print_file_likelihoods(const std::vector<double> &params_vec, std::vector<MOMAdata> &cells, 
+                            const std::vector<std::string> &infiles){
+    /*
+    * prints the contribution of each input file to the total log likelihood
+    */
+    std::vector<std::vector<MOMAdata*>> file_roots(infiles.size());
     std::vector<MOMAdata *> p_roots = get_roots(cells);
-    return total_likelihood(params_vec, g, &p_roots);
+    for(size_t i=0; i < p_roots.size(); ++i){
+        file_roots[p_roots[i]->file_idx].push_back(p_roots[i]);
+    }
+
+    std::cout << "Log likelihood per input file:\n";
+    for(size_t i=0; i < infiles.size(); ++i){
+        std::cout << pad_str(infiles[i], 40) << std::setprecision(10) 
+                  << trees_likelihood(params_vec, file_roots[i]) << "\n";
+    }
 }
 
 /* --------------------------------------------------------------------------
@@ -252,10 +342,11 @@ std::vector<double> ll_error_bars(Parameter_set &params, std::vector<MOMAdata> &
 * OUTPUT
 * -------------------------------------------------------------------------- */
 
-void setup_outfile_likelihood(std::string outfile, Parameter_set params){
+void setup_outfile_likelihood(std::string outfile, Parameter_set params, std::string settings=""){
+    /* settings (e.g. of the minimizer) are appended to the 'likelihoods:' line, such that the line count is unchanged */
     params.to_csv(outfile);
     std::ofstream file(outfile,std::ios_base::app);
-    file << "\nlikelihoods:\niteration,";
+    file << "\nlikelihoods:" << (settings.size() ? " " + settings : "") << "\niteration,";
     for (size_t i=0; i<params.all.size(); ++i){
         file << params.all[i].name << ",";
     }
@@ -263,6 +354,39 @@ void setup_outfile_likelihood(std::string outfile, Parameter_set params){
     file.close();
 }
 
+
+bool best_logged_likelihood(std::string outfile, std::vector<double> &params_vec, int &iterations){
+    /* 
+    * point with the highest likelihood in a log written by total_likelihood (and setup_outfile_likelihood), 
+    * iterations is the number of the last logged evaluation, returns false if nothing is logged
+    */
+    std::ifstream file(outfile);
+    std::string line;
+    size_t n_columns = 0;
+    double best = -HUGE_VAL;
+    iterations = 0;
+    while (getline(file, line)){
+        std::vector<std::string> parts = split_string_at(line, ",");
+        if (!n_columns){
+            if (line.rfind("iteration,", 0) == 0)
+                n_columns = parts.size();
+            continue;
+        }
+        // the last row of a killed run may be incomplete
+        if (parts.size() != n_columns || !parts.back().size())
+            continue;
+        std::vector<double> values;
+        for (size_t i=0; i<parts.size(); ++i)
+            values.push_back(std::stod(parts[i]));
+        iterations = std::max(iterations, (int) values[0]);
+        if (values.back() > best){
+            best = values.back();
+            params_vec.assign(values.begin() + 1, values.end() - 1);
+        }
+    }
+    return best > -HUGE_VAL;
+}
+
 /* -------------------------------------------------------------------------- */
 std::string outfile_name_minimization(std::map<std::string, std::string> arguments, Parameter_set params){
     std::string outfile = out_dir(arguments);
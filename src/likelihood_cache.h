@@ -0,0 +1,231 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#ifndef LIKELIHOOD_CACHE_H
+#define LIKELIHOOD_CACHE_H
+
+// ============================================================================= //
+// LIKELIHOOD CACHE
+// ============================================================================= //
+
+std::string cache_key(const std::vector<double> &params_vec){
+    /* bit pattern of the parameter vector */
+    std::string k(params_vec.size() * sizeof(double), '\0');
+    std::memcpy(&k[0], params_vec.data(), k.size());
+    return k;
+}
+
+
+class Likelihood_cache{
+    /*
+    * Bounded in-memory cache of likelihood evaluations. The key is the bit pattern of the parameter
+    * vector, i.e. only exactly identical parameters are reused (e.g. points requested twice by the
+    * minimizer or by the hessian). When the cache is full the oldest entry is dropped.
+    * Thread-safe, the concurrent minimizations of a multistart share the cache
+    */
+public:
+    void set_capacity(size_t n){
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = n;
+        while (order.size() > capacity){
+            entries.erase(order.front());
+            order.pop_front();
+        }
+    }
+
+    bool lookup(const std::vector<double> &params_vec, double &value){
+        /* sets value and returns true if params_vec was evaluated before */
+        if (!capacity)
+            return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(cache_key(params_vec));
+        if (it == entries.end()){
+            ++n_misses;
+            return false;
+        }
+        ++n_hits;
+        value = it->second;
+        return true;
+    }
+
+    void insert(const std::vector<double> &params_vec, double value){
+        if (!capacity)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string k = cache_key(params_vec);
+        if (!entries.emplace(k, value).second)
+            return;
+        order.push_back(k);
+        if (order.size() > capacity){
+            entries.erase(order.front());
+            order.pop_front();
+        }
+    }
+
+    size_t hits() const{
+        return n_hits;
+    }
+
+    size_t misses() const{
+        return n_misses;
+    }
+
+    size_t size() const{
+        return order.size();
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, double> entries;
+    std::deque<std::string> order;
+    size_t capacity = 0;
+    size_t n_hits = 0;
+    size_t n_misses = 0;
+};
+
+
+class Likelihood_disk_cache{
+    /*
+    * Persistent cache of likelihood evaluations that is shared by runs and by concurrent jobs, an 
+    * append-only text file with one evaluation per line:
+    *     <data fingerprint> <model version> <parameters...> <log likelihood>
+    * with the numbers as hexadecimal floats (exact). Only the lines of the same data set and model 
+    * version are used. Lines are appended with a single write under an exclusive lock (flock) and read 
+    * under a shared lock, on a miss the lines appended by other jobs since the last read are read
+    */
+public:
+    ~Likelihood_disk_cache(){
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    bool open(std::string filename, uint64_t fingerprint, std::string version){
+        fd = ::open(filename.c_str(), O_RDWR | O_APPEND | O_CREAT, 0644);
+        if (fd < 0){
+            std::cerr << "(Likelihood_disk_cache) Error: could not open " << filename << std::endl;
+            return false;
+        }
+        std::stringstream ss;
+        ss << std::hex << fingerprint << " " << version << " ";
+        prefix = ss.str();
+        std::lock_guard<std::mutex> lock(mutex);
+        read_new();
+        return true;
+    }
+
+    bool is_open() const{
+        return fd >= 0;
+    }
+
+    bool lookup(const std::vector<double> &params_vec, double &value){
+        /* sets value and returns true if params_vec was evaluated before (by any run on the same data) */
+        if (fd < 0)
+            return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string k = cache_key(params_vec);
+        auto it = entries.find(k);
+        if (it == entries.end()){
+            read_new();
+            it = entries.find(k);
+        }
+        if (it == entries.end()){
+            ++n_misses;
+            return false;
+        }
+        ++n_hits;
+        value = it->second;
+        return true;
+    }
+
+    void insert(const std::vector<double> &params_vec, double value){
+        if (fd < 0)
+            return;
+        std::stringstream line;
+        line << prefix << std::hexfloat;
+        for (size_t i=0; i<params_vec.size(); ++i)
+            line << params_vec[i] << " ";
+        line << value << "\n";
+        std::string l = line.str();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.emplace(cache_key(params_vec), value);
+        flock(fd, LOCK_EX);
+        if (write(fd, l.data(), l.size()) != (ssize_t) l.size())
+            std::cerr << "(Likelihood_disk_cache) Error: could not append to the cache" << std::endl;
+        flock(fd, LOCK_UN);
+    }
+
+    size_t hits() const{
+        return n_hits;
+    }
+
+    size_t misses() const{
+        return n_misses;
+    }
+
+    size_t size() const{
+        return entries.size();
+    }
+
+private:
+    std::mutex mutex;
+    int fd = -1;
+    std::string prefix;
+    off_t read_pos = 0;
+    std::unordered_map<std::string, double> entries;
+    size_t n_hits = 0;
+    size_t n_misses = 0;
+
+    void read_new(){
+        /* reads the complete lines appended since the last read */
+        flock(fd, LOCK_SH);
+        struct stat st;
+        std::string buffer;
+        if (fstat(fd, &st) == 0 && st.st_size > read_pos){
+            buffer.resize(st.st_size - read_pos);
+            ssize_t n = pread(fd, &buffer[0], buffer.size(), read_pos);
+            buffer.resize(n > 0 ? n : 0);
+        }
+        flock(fd, LOCK_UN);
+
+        size_t start = 0, end;
+        while ((end = buffer.find('\n', start)) != std::string::npos){
+            if (buffer.compare(start, prefix.size(), prefix) == 0)
+                parse_line(buffer.substr(start + prefix.size(), end - start - prefix.size()));
+            start = end + 1;
+        }
+        read_pos += start;
+    }
+
+    void parse_line(const std::string &line){
+        std::vector<double> values;
+        const char *p = line.c_str();
+        char *next;
+        while (true){
+            double v = std::strtod(p, &next);
+            if (next == p)
+                break;
+            values.push_back(v);
+            p = next;
+        }
+        if (values.size() < 2)
+            return;
+        double value = values.back();
+        values.pop_back();
+        entries.emplace(cache_key(values), value);
+    }
+};
+
+#endif
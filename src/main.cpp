@@ -2,26 +2,345 @@
 
 #include "likelihood.h"
 #include "minimizer_nlopt.h"
+#include "minimizer_spsa.h"
+#include "minimizer_bayes.h"
 
 #include "tests.h"
+#include "prediction_store.h"
 #include <filesystem>
 #include <iostream> 
 #include <iterator> 
 #include <iomanip> 
 
 
+bool resume_point(Parameter_set &params, std::string outfile, std::vector<double> &init, 
+                  Minimizer_settings &settings, int &iteration){
+    /*
+    * starting point (init) of a resumed minimization: the checkpoint or, if there is none, the best point 
+    * logged in outfile, returns false if there is neither. iteration is the last logged evaluation and 
+    * the evaluations that are already done are subtracted from maxeval
+    */
+    std::vector<double> point;
+    int evaluations;
+    bool logged = best_logged_likelihood(outfile, point, iteration);
+    if (read_checkpoint(settings.checkpoint, params, point, evaluations)){
+        std::cout << "Resume from " << settings.checkpoint << " after " << evaluations << " evaluations\n";
+    } else if (logged && point.size() == init.size()){
+        evaluations = iteration;
+        std::cout << "Resume from the best point in " << outfile << " after " << evaluations << " evaluations\n";
+    } else {
+        return false;
+    }
+    // only the non-fixed parameters are resumed, the fixed ones are taken from the parameter file
+    std::vector<int> free_idx = params.non_fixed();
+    for (size_t i=0; i<free_idx.size(); ++i)
+        init[free_idx[i]] = point[free_idx[i]];
+    settings.resumed_evaluations = evaluations;
+    if (settings.maxeval > 0)
+        settings.maxeval = std::max(settings.maxeval - evaluations, 1);
+    return true;
+}
+
+
+std::vector<double> run_bayes(std::vector<MOMAdata> &cells, Parameter_set &params, Minimizer_settings &settings,
+                              std::map<std::string, std::string> arguments, std::vector<double> init){
+    /*
+    * Bayesian optimization (minimize_bayes) within the bounds of the parameter file, the points of a 
+    * batch (default: one per thread) are evaluated concurrently. Returns the best point as starting 
+    * point of the local minimization, the evaluations are logged to <outfile>_bayes.csv and count 
+    * towards maxeval of the local minimization (settings). On SIGTERM the best point is written to 
+    * the checkpoint of the minimization
+    */
+    Thread_pool pool(std::stoi(arguments["threads"]));
+    int evaluations = std::stoi(arguments["bayes"]);
+    size_t batch = std::stoul(arguments["bayes_batch"]);
+    batch = batch ? batch : pool.size();
+
+    std::string outfile = _outfile_ll.substr(0, _outfile_ll.size() - 4) + "_bayes.csv";
+    setup_outfile_likelihood(outfile, params, "bayes=" + arguments["bayes"] + ",batch=" + std::to_string(batch));
+    Likelihood_data data(get_roots(cells), outfile, "[bayes] ");
+
+    std::cout << "Bayesian optimization: " << evaluations << " evaluations in batches of " << batch << " on " 
+              << pool.size() << " threads, outfile: " << outfile << "\n";
+    Minimizer_result result = minimize_bayes(&total_likelihood, &data, params, evaluations, batch, pool, init);
+    if (_minimizer_stop){
+        std::cout << "Bayesian optimization stopped by signal after " << result.evaluations << " evaluations\n";
+        if (!result.success)
+            return init;
+        std::vector<std::string> names;
+        for (size_t i=0; i<params.all.size(); ++i)
+            names.push_back(params.all[i].name);
+        write_checkpoint(settings.checkpoint, names, result.params_vec, result.minf, settings.resumed_evaluations + result.evaluations, 
+                         "stopped by signal in the Bayesian optimization");
+        std::cout << "Checkpoint: " << settings.checkpoint << std::endl;
+        return result.params_vec;
+    }
+    if (!result.success){
+        std::cout << "Bayesian optimization " << result.status << "\n";
+        return init;
+    }
+    std::cout << "Bayesian optimization done: " << result.status << ", log likelihood " << std::setprecision(10) 
+              << -result.minf << " after " << result.evaluations << " evaluations\n" << std::setprecision(6);
+    settings.resumed_evaluations += result.evaluations;
+    if (settings.maxeval > 0)
+        settings.maxeval = std::max(settings.maxeval - result.evaluations, 1);
+    std::cout << "Local minimization from the best point\n";
+    return result.params_vec;
+}
+
+
+std::vector<double> run_spsa(std::vector<MOMAdata> &cells, Parameter_set &params, 
+                             Minimizer_settings settings, std::map<std::string, std::string> arguments, 
+                             std::vector<double> init){
+    /*
+    * stochastic minimization (minimize_spsa) on random batches of root lineages, the batch grows 
+    * geometrically from the spsa-batch flag (default: 5% of the lineages) to all lineages in the last 
+    * iteration and its likelihood is rescaled to all lineages (n_roots/batch size). Returns the starting 
+    * point of the minimization on all lineages. The (rescaled) evaluations are logged to <outfile>_spsa.csv 
+    * and are not cached. On SIGTERM the current point is written to the checkpoint of the minimization
+    */
+    std::vector<MOMAdata *> roots = get_roots(cells);
+    size_t n_roots = roots.size();
+    int iterations = std::stoi(arguments["spsa"]);
+    size_t batch = std::stoul(arguments["spsa_batch"]);
+    batch = std::min(n_roots, batch ? batch : std::max<size_t>(1, n_roots / 20));
+
+    std::string checkpoint = settings.checkpoint;
+    settings.checkpoint = "";
+    std::string outfile = _outfile_ll.substr(0, _outfile_ll.size() - 4) + "_spsa.csv";
+    setup_outfile_likelihood(outfile, params, settings.str() + ",spsa=" + arguments["spsa"] + ",batch=" + std::to_string(batch));
+    Likelihood_data data(roots, outfile, "[spsa] ");
+    data.cache = false;
+
+    std::mt19937 generator(1);
+    auto next_batch = [&](int k){
+        double fraction = iterations > 1 ? k / (iterations - 1.) : 1;
+        size_t b = std::round(batch * std::pow((double) n_roots / batch, fraction));
+        std::shuffle(roots.begin(), roots.end(), generator);
+        data.roots.assign(roots.begin(), roots.begin() + b);
+        data.scale = (double) n_roots / b;
+    };
+
+    std::cout << "SPSA: " << iterations << " iterations, batch of " << batch << " to " << n_roots 
+              << " lineages, outfile: " << outfile << "\n";
+    Minimizer_result result = minimize_spsa(&total_likelihood, &data, next_batch, params, settings, iterations, init);
+    std::cout << "SPSA done: " << result.status << ", log likelihood (last batch) " << std::setprecision(10) 
+              << -result.minf << " after " << result.evaluations << " evaluations\n" << std::setprecision(6);
+    if (_minimizer_stop){
+        std::vector<std::string> names;
+        for (size_t i=0; i<params.all.size(); ++i)
+            names.push_back(params.all[i].name);
+        if (result.evaluations > 0){
+            write_checkpoint(checkpoint, names, result.params_vec, result.minf, settings.resumed_evaluations + result.evaluations, 
+                             "stopped by signal in SPSA");
+            std::cout << "Checkpoint: " << checkpoint << std::endl;
+        }
+        return result.params_vec;
+    }
+    if (!result.success)
+        return init;
+    std::cout << "Full-batch refinement\n";
+    return result.params_vec;
+}
+
+
+std::vector<double> run_coarse_to_fine(std::vector<MOMAdata> &cells, Parameter_set &params, 
+                                       Minimizer_settings settings, std::map<std::string, std::string> arguments, 
+                                       std::vector<double> init){
+    /*
+    * minimizations on thinned data, every k-th time point for each k of the coarse-to-fine flag (e.g. 8,4,2),
+    * each starting at the result of the previous level and with the tolerance k*rel_tol. Returns the 
+    * starting point of the minimization on the full data. The evaluations of level k are logged 
+    * to <outfile>_thin<k>.csv and are not cached. On SIGTERM the remaining levels are skipped and 
+    * the best point so far is written to the checkpoint of the minimization
+    */
+    std::vector<std::string> levels = split_string_at(arguments["coarse_to_fine"], ",");
+    std::string outfile_base = _outfile_ll.substr(0, _outfile_ll.size() - 4);
+    std::string checkpoint = settings.checkpoint;
+    settings.checkpoint = "";
+    double level_f = NAN; // target function at init on the level that found it
+    for (size_t l=0; l<levels.size(); ++l){
+        size_t k = std::stoul(levels[l]);
+        std::vector<MOMAdata> thinned = thin_cells(cells, k);
+        init_cells(thinned, 5);
+        size_t n_points = 0;
+        for (size_t i=0; i<thinned.size(); ++i)
+            n_points += thinned[i].time.size();
+
+        Minimizer_settings level_settings = settings;
+        level_settings.xtol_rel = settings.xtol_rel * k;
+        std::string outfile = outfile_base + "_thin" + levels[l] + ".csv";
+        setup_outfile_likelihood(outfile, params, level_settings.str() + ",thin=" + levels[l]);
+        Likelihood_data data(get_roots(thinned), outfile, "[thin " + levels[l] + "] ");
+        data.cache = false;
+
+        std::cout << "Level: every " << k << ". time point (" << n_points << " data points), outfile: " << outfile << "\n";
+        Minimizer_result result = minimize(&total_likelihood, &data, params, level_settings, init);
+        std::cout << "Level " << k << " done: " << result.status << ", log likelihood " << std::setprecision(10) 
+                  << -result.minf << " after " << result.evaluations << " evaluations\n" << std::setprecision(6);
+        if (result.params_vec.size()){
+            init = result.params_vec;
+            level_f = result.minf;
+        }
+        if (_minimizer_stop){
+            std::vector<std::string> names;
+            for (size_t i=0; i<params.all.size(); ++i)
+                names.push_back(params.all[i].name);
+            if (!is_nan(level_f)){
+                write_checkpoint(checkpoint, names, init, level_f, settings.resumed_evaluations, 
+                                 "stopped by signal at level " + levels[l] + " of coarse-to-fine");
+                std::cout << "Checkpoint: " << checkpoint << std::endl;
+            }
+            return init;
+        }
+    }
+    std::cout << "Level: full data\n";
+    return init;
+}
+
+
+void run_multistart(std::vector<MOMAdata> &cells, Parameter_set &params, 
+                    const Minimizer_settings &settings, std::map<std::string, std::string> arguments){
+    /*
+    * independent minimizations from the init values (start 0) and from points of a latin hypercube
+    * within the bounds, run concurrently on a pool of threads. Each start logs its evaluations to its 
+    * own file (<outfile>_start<i>.csv) and has its own checkpoint, the (global) outfile gets the final 
+    * point of each start
+    */
+    size_t n_starts = std::stoi(arguments["multistart"]);
+    std::vector<std::vector<double>> inits = latin_hypercube(params, n_starts - 1);
+    inits.insert(inits.begin(), params.get_init());
+
+    std::vector<MOMAdata *> p_roots = get_roots(cells);
+    std::string outfile_base = _outfile_ll.substr(0, _outfile_ll.size() - 4);
+    std::vector<std::unique_ptr<Likelihood_data>> data;
+    std::vector<Minimizer_result> results(n_starts);
+    std::vector<Minimizer_settings> start_settings(n_starts, settings);
+    for (size_t i=0; i<n_starts; ++i){
+        std::string outfile = outfile_base + "_start" + std::to_string(i) + ".csv";
+        start_settings[i].checkpoint = outfile_base + "_start" + std::to_string(i) + "_checkpoint.txt";
+        int iteration = 0;
+        bool resumed = false;
+        if (arguments.count("resume")){
+            std::cout << "[" << i << "] ";
+            resumed = resume_point(params, outfile, inits[i], start_settings[i], iteration);
+            if (!resumed)
+                std::cout << "Nothing to resume, start at the " << (i ? "latin hypercube point" : "init values") << "\n";
+        }
+        if (!resumed || !std::filesystem::exists(outfile))
+            setup_outfile_likelihood(outfile, params, settings.str() + ",start=" + std::to_string(i));
+        data.emplace_back(new Likelihood_data(p_roots, outfile, "[" + std::to_string(i) + "] "));
+        data.back()->iteration = iteration;
+    }
+
+    Thread_pool pool(std::stoi(arguments["threads"]));
+    std::cout << "Starts: " << n_starts << ", threads: " << pool.size() << "\n";
+    for (size_t i=0; i<n_starts; ++i){
+        pool.submit([&, i]{ 
+            results[i] = minimize(&total_likelihood, data[i].get(), params, start_settings[i], inits[i]); 
+            std::stringstream out;
+            out << "Start " << i << " done: " << results[i].status << ", log likelihood " 
+                << std::setprecision(10) << -results[i].minf << "\n";
+            std::cout << out.str();
+        });
+    }
+    pool.wait();
+
+    /* final point of each start to the outfile and summary, best first */
+    std::vector<size_t> order;
+    std::ofstream file(_outfile_ll, std::ios_base::app);
+    for (size_t i=0; i<n_starts; ++i){
+        if (results[i].params_vec.size()){
+            order.push_back(i);
+            file << i << ",";
+            for (size_t j=0; j<results[i].params_vec.size(); ++j)
+                file << results[i].params_vec[j] << ",";
+            file << std::setprecision(10) << -results[i].minf << "\n" << std::setprecision(6);
+        }
+    }
+    file.close();
+    if (!order.size()){
+        std::cout << "All starts failed" << std::endl;
+        return;
+    }
+    std::sort(order.begin(), order.end(), [&results](size_t a, size_t b){ 
+        if (is_nan(results[b].minf))
+            return !is_nan(results[a].minf); // NaN last
+        return results[a].minf < results[b].minf; });
+
+    std::cout << "\n" << pad_str("start", 7) << pad_str("init ll", 16) << pad_str("final ll", 16) 
+              << pad_str("evaluations", 13) << "status\n";
+    for (size_t k=0; k<order.size(); ++k){
+        const Minimizer_result &r = results[order[k]];
+        std::stringstream init_ll, final_ll;
+        init_ll << std::setprecision(10) << -r.init_f;
+        final_ll << std::setprecision(10) << -r.minf;
+        std::cout << pad_str(std::to_string(order[k]), 7) << pad_str(init_ll.str(), 16) << pad_str(final_ll.str(), 16) 
+                  << pad_str(std::to_string(r.evaluations), 13) << r.status << "\n";
+    }
+
+    /* starts within ftol_abs (default 1e-3) of the best log likelihood count as converged to the same optimum */
+    size_t best = order[0];
+    double tolerance = settings.ftol_abs > 0 ? settings.ftol_abs : 1e-3;
+    size_t n_converged = 0;
+    for (size_t k=0; k<order.size(); ++k)
+        n_converged += std::abs(results[order[k]].minf - results[best].minf) <= tolerance;
+    std::cout << n_converged << " of " << n_starts << " starts reached the best log likelihood " 
+              << std::setprecision(10) << -results[best].minf << " (start " << best << ") within " 
+              << tolerance << "\n" << std::setprecision(6);
+
+    params.set_final(results[best].params_vec);
+    std::cout << params << std::endl;
+}
+
+
 void run_minimization(std::vector<MOMAdata> &cells, Parameter_set &params, 
                       std::map<std::string, std::string> arguments){
     std::cout << "-> Minimizaton" << "\n";
     init_cells(cells, 5);
 
-    /* set and setup (global) output file */
+    Minimizer_settings settings;
+    settings.algorithm = arguments["algorithm"];
+    settings.xtol_rel = std::stod(arguments["rel_tol"]);
+    settings.ftol_rel = std::stod(arguments["ftol_rel"]);
+    settings.ftol_abs = std::stod(arguments["ftol_abs"]);
+    settings.maxeval = std::stoi(arguments["maxeval"]);
+    settings.maxtime = std::stod(arguments["maxtime"]);
+    settings.population = std::stoi(arguments["population"]);
+    settings.transform = arguments["transform"];
+    std::cout << "Minimizer: " << settings.str() << "\n";
+
+    /* set and setup (global) output file, with --resume an existing one is continued */
     _outfile_ll = outfile_name_minimization(arguments, params);
-    setup_outfile_likelihood(_outfile_ll, params);
+    bool multistart = std::stoi(arguments["multistart"]) > 1;
+    std::string settings_str = settings.str() + (multistart ? ",multistart=" + arguments["multistart"] : "");
+    if (!arguments.count("resume") || !std::filesystem::exists(_outfile_ll))
+        setup_outfile_likelihood(_outfile_ll, params, settings_str);
     std::cout << "Outfile: " << _outfile_ll << "\n";
 
-    /* minimization for tree starting from cells[0] */
-    minimize_wrapper(&total_likelihood, cells, params, std::stod(arguments["rel_tol"] ));
+    /* SIGUSR1 writes the checkpoints, SIGTERM also stops the minimization */
+    install_minimizer_signal_handlers();
+
+    if (multistart){
+        run_multistart(cells, params, settings, arguments);
+    } else {
+        /* minimization for tree starting from cells[0] */
+        settings.checkpoint = _outfile_ll.substr(0, _outfile_ll.size() - 4) + "_checkpoint.txt";
+        std::cout << "Checkpoint: " << settings.checkpoint << "\n";
+        std::vector<double> init = params.get_init();
+        Likelihood_data data(get_roots(cells), _outfile_ll);
+        if (arguments.count("resume") && !resume_point(params, _outfile_ll, init, settings, data.iteration))
+            std::cout << "Nothing to resume, start at the init values\n";
+        if (arguments.count("bayes"))
+            init = run_bayes(cells, params, settings, arguments, init);
+        if (arguments.count("spsa") && !_minimizer_stop)
+            init = run_spsa(cells, params, settings, arguments, init);
+        if (arguments.count("coarse_to_fine") && !_minimizer_stop)
+            init = run_coarse_to_fine(cells, params, settings, arguments, init);
+        if (!_minimizer_stop)
+            minimize_wrapper(&total_likelihood, &data, params, settings, init);
+    }
+    restore_default_signal_handlers();
 }
 
 
@@ -62,50 +381,131 @@ void run_bound_1dscan(std::vector<MOMAdata> &cells, Parameter_set params,
 void run_prediction(std::vector<MOMAdata> &cells, Parameter_set params, 
                     std::map<std::string, std::string> arguments){
     std::cout << "-> prediction" << "\n";
+    bool rts = arguments.count("rts");
+    std::string outputs = arguments.count("write") ? arguments["write"] : "fbc";
+    if (rts && !arguments.count("write"))
+        outputs = "fc";
+    else if (rts && outputs.find('b') != std::string::npos){
+        std::cout << "No backward prediction is written with the rts flag\n";
+        outputs.erase(std::remove(outputs.begin(), outputs.end(), 'b'), outputs.end());
+    }
     
-    std::string outfile = outfile_name_prediction(arguments);
-    std::string outfile_b = outfile_name_prediction(arguments, "_backward");
-    std::string outfile_f = outfile_name_prediction(arguments, "_forward");
-
-
-    std::cout << "Outfile: " << outfile << "\n";
-    std::cout << "Outfile backward: " << outfile_b << "\n";
-    std::cout << "Outfile forward: " << outfile_f << "\n";
+    std::string format = arguments["output_format"];
+    std::map<char, std::string> outfiles;
+    if (outputs.find('c') != std::string::npos)
+        outfiles['c'] = outfile_name_prediction(arguments, "", "." + format);
+    if (outputs.find('b') != std::string::npos)
+        outfiles['b'] = outfile_name_prediction(arguments, "_backward", "." + format);
+    if (outputs.find('f') != std::string::npos)
+        outfiles['f'] = outfile_name_prediction(arguments, "_forward", "." + format);
+
+    if (outfiles.count('c'))
+        std::cout << "Outfile: " << outfiles['c'] << "\n";
+    if (outfiles.count('b'))
+        std::cout << "Outfile backward: " << outfiles['b'] << "\n";
+    if (outfiles.count('f'))
+        std::cout << "Outfile forward: " << outfiles['f'] << "\n";
 
 
     std::vector<double> params_vec = params.get_final();
 
-    /* forward...*/
     init_cells(cells, 5);
-    prediction_forward(params_vec, cells);
-
-    /* backward...*/
-    init_cells_r(cells, 5);
-    prediction_backward(params_vec, cells);
+    if (!rts)
+        init_cells_r(cells, 5);
+
+    /* restrict the prediction to the selected cells/lineages and the cells they depend on */
+    if (arguments.count("predict_cells") || arguments.count("predict_lineages")){
+        std::vector<std::string> cell_ids, lineage_ids;
+        if (arguments.count("predict_cells"))
+            cell_ids = split_string_at(arguments["predict_cells"], ",");
+        if (arguments.count("predict_lineages"))
+            lineage_ids = split_string_at(arguments["predict_lineages"], ",");
+        size_t n_selected = select_cells(cells, cell_ids, lineage_ids, rts && outputs.find('c') != std::string::npos);
+        std::cout << "Selected cells: " << n_selected << "\n";
+        if (!n_selected)
+            return;
+    }
 
-    /* combine the two */
-    combine_predictions(cells);
+    /* 
+    * The lineages are predicted concurrently on a pool of threads, each in its own arena, and written 
+    * as soon as they are finished. Within a lineage, forward and backward run concurrently, each on its 
+    * own state, forward starting at the root, backward at the leafs where a parent cell is started once 
+    * both daughters are done, each cell is combined by the direction that finishes it last.
+    * The smoother replaces backward and combination by a single sweep starting at the leafs
+    */
+    Thread_pool pool(std::stoi(arguments["threads"]));
+    std::cout << "Threads: " << pool.size() << "\n";
+    Lineage_prediction prediction(params_vec, cells, outputs, rts);
+    Prediction_columns columns;
+    if (arguments.count("predict_columns"))
+        columns.parse(arguments["predict_columns"]);
+    columns.every = std::stoi(arguments["predict_every"]);
+    prediction.run(outfiles, params, pool, 2 * pool.size(), format, columns);
+}
 
-    /* save */
-    write_pretictions_to_file(cells, outfile_b, params, "b");
-    write_pretictions_to_file(cells, outfile_f, params, "f");
 
-    write_pretictions_to_file(cells, outfile, params);
+int run_query(std::map<std::string, std::string> arguments){
+    /* prints the prediction of a cell (or its lineage) from a npz prediction file as csv */
+    Prediction_store store;
+    if (!store.open(arguments["query_file"]))
+        return 1;
+    long idx = store.find_cell(arguments["query_cell"]);
+    if (idx < 0){
+        std::cerr << "Cell " << arguments["query_cell"] << " not found in " << arguments["query_file"] << std::endl;
+        return 1;
+    }
+    std::vector<size_t> cell_indices = {(size_t) idx};
+    if (arguments.count("lineage"))
+        cell_indices = store.lineage(idx);
+
+    std::cout << "cell_id,time,log_length,fp";
+    for (size_t i=0; i<store.column_names().size(); ++i)
+        std::cout << "," << store.column_names()[i];
+    std::cout << "\n";
+    for (size_t i=0; i<cell_indices.size(); ++i)
+        store.write_rows(std::cout, cell_indices[i]);
+    return 0;
 }
 
 
 std::map<std::string, std::string> arg_parser(int argc, char** argv){
     std::vector<std::vector<std::string>> keys = {
         {"-h","--help", "help message"},
-        {"-i", "--infile", "(required) input/data file"},
+        {"-i", "--infile", "(required) input/data file(s), directory or glob, '-' reads from stdin"},
         {"-b", "--parameter_bounds", "(required) file defining the type, step, bounds of the parameters"},
         {"-c", "--csv_config", "file that sets the colums that will be used from the input file"},
         {"-l","--print_level", "print level >=0, default=0"},
         {"-o","--outdir", "specify output direction and do not use default"},
         {"-r","--rel_tol", "relative tolerance of maximization, default=1e-2"},
         {"-m","--maximize", "run maximization"},
+        {"-a","--algorithm", "algorithm of the maximization (nlopt): cobyla, bobyqa, newuoa, neldermead, sbplx, praxis, lbfgs, slsqp, mma, ccsaq, tnewton, direct, crs, isres, esch, mlsl, default=cobyla"},
+        {"-me","--maxeval", "maximal number of likelihood evaluations of the maximization (including those of numerical gradients), default=0 (no limit)"},
+        {"-mt","--maxtime", "maximal time of the maximization in seconds, default=0 (no limit)"},
+        {"-fr","--ftol_rel", "relative tolerance of the likelihood (maximization), default=0 (not used)"},
+        {"-fa","--ftol_abs", "absolute tolerance of the likelihood (maximization), default=0 (not used)"},
+        {"-re","--resume", "continue a minimization (same outfile) from its checkpoint or the best point of its log"},
+        {"-cf","--coarse-to-fine", "comma separated k, e.g. 8,4,2: minimize on every k-th time point first, then on the full data"},
+        {"-sp","--spsa", "number of SPSA iterations on random batches of lineages before the minimization on all lineages, default=0 (off)"},
+        {"-sb","--spsa-batch", "initial number of lineages of the SPSA batches (grows to all lineages), default=0 (5% of the lineages)"},
+        {"-bo","--bayes", "number of likelihood evaluations of a Bayesian optimization (all non-fixed parameters need bounds) before the local minimization (they count towards maxeval), default=0 (off)"},
+        {"-bb","--bayes-batch", "number of points evaluated concurrently per round of the Bayesian optimization, default=0 (number of threads)"},
+        {"-ms","--multistart", "number of minimizations from different starting points (init values and latin hypercube within the bounds), run on threads, default=1"},
+        {"-np","--population", "population size of crs, isres, esch and mlsl, default=0 (nlopt default)"},
+        {"-tr","--transform", "coordinates of the maximization: log (log of free variances/rates, scaled logit of bound parameters) or none, default=log"},
+        {"-cs","--cache-size", "number of likelihood evaluations kept in memory, identical parameters are not evaluated again, default=10000 (0: off)"},
+        {"-dc","--disk-cache", "file of likelihood evaluations that is shared by runs (and concurrent jobs) on the same data, created if needed"},
         {"-s","--scan", "run 1d parameter scan"},
-        {"-p","--predict", "run prediction"}
+        {"-p","--predict", "run prediction"},
+        {"-t","--threads", "number of threads of the prediction and multistart, default=number of cores"},
+        {"-R","--rts", "prediction via Rauch-Tung-Striebel smoothing, no backward prediction"},
+        {"-w","--write", "predictions that are written: f(orward), b(ackward), c(ombined), default=fbc"},
+        {"-f","--output-format", "format of the prediction files: csv or npz, default=csv"},
+        {"-pc","--predict-cells", "comma separated cell ids: run the prediction only for those cells"},
+        {"-pl","--predict-lineages", "comma separated cell ids: run the prediction only for the lineages of those cells"},
+        {"-pcol","--predict-columns", "comma separated columns of the prediction files, e.g. mean_l,sd_l,mean_q,sd_q"},
+        {"-pk","--predict-every", "write only every k-th time point of each cell, default=1"},
+        {"-q","--query", "<npz file> <cell_id>: print the prediction of a cell from a npz prediction file"},
+        {"-L","--lineage", "with query: print the predictions of all cells of the lineage of the cell"}
         };
 
     std::map<std::string, int> key_indices; 
@@ -117,12 +517,34 @@ std::map<std::string, std::string> arg_parser(int argc, char** argv){
     /* defaults: */
     arguments["print_level"] = "0";
     arguments["rel_tol"] = "1e-2";
+    arguments["algorithm"] = "cobyla";
+    arguments["maxeval"] = "0";
+    arguments["maxtime"] = "0";
+    arguments["ftol_rel"] = "0";
+    arguments["ftol_abs"] = "0";
+    arguments["population"] = "0";
+    arguments["transform"] = "log";
+    arguments["cache_size"] = "10000";
+    arguments["spsa_batch"] = "0";
+    arguments["bayes_batch"] = "0";
+    arguments["multistart"] = "1";
+    arguments["threads"] = std::to_string(default_threads());
+    arguments["output_format"] = "csv";
+    arguments["predict_every"] = "1";
 
     for(int k=0; k<keys.size(); ++k){
         for(int i=1; i<argc ; ++i){
             if (argv[i] == keys[k][0] || argv[i] == keys[k][1]){
-                 if(k==key_indices["-i"]) 
-                    arguments["infile"] = argv[i+1];
+                 if(k==key_indices["-i"]){
+                    /* all following values until the next flag are input files */
+                    for(int j=i+1; j<argc && (argv[j][0] != '-' || std::string(argv[j]) == "-"); ++j){
+                        if (arguments.count("infiles"))
+                            arguments["infiles"] += "\n";
+                        arguments["infiles"] += argv[j];
+                    }
+                    if (arguments.count("infiles"))
+                        arguments["infile"] = split_string_at(arguments["infiles"], "\n")[0];
+                 }
                 else if(k==key_indices["-b"]) 
                     arguments["parameter_bounds"] = argv[i+1];
                 else if(k==key_indices["-c"]) 
@@ -135,10 +557,71 @@ std::map<std::string, std::string> arg_parser(int argc, char** argv){
                     arguments["rel_tol"] = argv[i+1];
                 else if(k==key_indices["-m"])
                     arguments["minimize"] = "1";
+                else if(k==key_indices["-a"])
+                    arguments["algorithm"] = argv[i+1];
+                else if(k==key_indices["-me"])
+                    arguments["maxeval"] = argv[i+1];
+                else if(k==key_indices["-mt"])
+                    arguments["maxtime"] = argv[i+1];
+                else if(k==key_indices["-fr"])
+                    arguments["ftol_rel"] = argv[i+1];
+                else if(k==key_indices["-fa"])
+                    arguments["ftol_abs"] = argv[i+1];
+                else if(k==key_indices["-re"])
+                    arguments["resume"] = "1";
+                else if(k==key_indices["-cf"])
+                    arguments["coarse_to_fine"] = argv[i+1];
+                else if(k==key_indices["-sp"])
+                    arguments["spsa"] = argv[i+1];
+                else if(k==key_indices["-sb"])
+                    arguments["spsa_batch"] = argv[i+1];
+                else if(k==key_indices["-bo"])
+                    arguments["bayes"] = argv[i+1];
+                else if(k==key_indices["-bb"])
+                    arguments["bayes_batch"] = argv[i+1];
+                else if(k==key_indices["-ms"])
+                    arguments["multistart"] = argv[i+1];
+                else if(k==key_indices["-np"])
+                    arguments["population"] = argv[i+1];
+                else if(k==key_indices["-tr"])
+                    arguments["transform"] = argv[i+1];
+                else if(k==key_indices["-cs"])
+                    arguments["cache_size"] = argv[i+1];
+                else if(k==key_indices["-dc"])
+                    arguments["disk_cache"] = argv[i+1];
                 else if(k==key_indices["-s"])
                     arguments["scan"] = "1";
                 else if(k==key_indices["-p"])
                     arguments["predict"] = "1";
+                else if(k==key_indices["-t"])
+                    arguments["threads"] = argv[i+1];
+                else if(k==key_indices["-R"])
+                    arguments["rts"] = "1";
+                else if(k==key_indices["-w"])
+                    arguments["write"] = argv[i+1];
+                else if(k==key_indices["-f"])
+                    arguments["output_format"] = argv[i+1];
+                else if(k==key_indices["-pc"]){
+                    arguments["predict"] = "1";
+                    arguments["predict_cells"] = argv[i+1];
+                }
+                else if(k==key_indices["-pl"]){
+                    arguments["predict"] = "1";
+                    arguments["predict_lineages"] = argv[i+1];
+                }
+                else if(k==key_indices["-pcol"])
+                    arguments["predict_columns"] = argv[i+1];
+                else if(k==key_indices["-pk"])
+                    arguments["predict_every"] = argv[i+1];
+                else if(k==key_indices["-q"]){
+                    arguments["query"] = "1";
+                    if (i+2 < argc){
+                        arguments["query_file"] = argv[i+1];
+                        arguments["query_cell"] = argv[i+2];
+                    }
+                }
+                else if(k==key_indices["-L"])
+                    arguments["lineage"] = "1";
                 else if (k==key_indices["-h"]){
                     arguments["quit"] = "1";
                     std::cout << "Usage: ./gfp_gaussian <infile> [-options]\n";
@@ -148,14 +631,47 @@ std::map<std::string, std::string> arg_parser(int argc, char** argv){
             }
         }
     }
+    /* a query only reads the given prediction file */
+    if (arguments.count("query")){
+        if (!arguments.count("query_file")){
+            std::cout << "The query flag requires a npz file and a cell_id (use '-h' for help)!" << std::endl;
+            arguments["quit"] = "1";
+        }
+        else if (!std::filesystem::exists(arguments["query_file"])){
+            std::cout << "Prediction file " << arguments["query_file"] << " not found (use '-h' for help)!" << std::endl;
+            arguments["quit"] = "1";
+        }
+        return arguments;
+    }
+
     /* Check is required filenames are parsed and files exist */
     if (!arguments.count("infile")){
         std::cout << "Required infile flag not set!\n";
         arguments["quit"] = "1";
     }
-    else if(! std::filesystem::exists(arguments["infile"])){
-        std::cout << "Infile " << arguments["infile"] << " not found (use '-h' for help)!" << std::endl;
-        arguments["quit"] = "1";
+    else {
+        /* expand directories and glob patterns, the outputs are named after the first file (or the directory) */
+        std::vector<std::string> values = split_string_at(arguments["infiles"], "\n");
+        std::vector<std::string> infiles = expand_infiles(values);
+        if (!infiles.size()){
+            std::cout << "No input files found for " << arguments["infile"] << " (use '-h' for help)!" << std::endl;
+            arguments["quit"] = "1";
+        }
+        arguments["infiles"] = "";
+        for(size_t i=0; i<infiles.size(); ++i){
+            if(infiles[i] != "-" && ! std::filesystem::exists(infiles[i])){
+                std::cout << "Infile " << infiles[i] << " not found (use '-h' for help)!" << std::endl;
+                arguments["quit"] = "1";
+            }
+            /* the default outdir is derived from the infile location, which does not exist for streams */
+            else if(is_stream_input(infiles[i]) && !arguments.count("outdir")){
+                std::cout << "Reading from stdin or a pipe requires the outdir flag (use '-h' for help)!" << std::endl;
+                arguments["quit"] = "1";
+            }
+            arguments["infiles"] += (i>0 ? "\n" : "") + infiles[i];
+        }
+        if (infiles.size() && (values.size() > 1 || is_glob(values[0])))
+            arguments["infile"] = infiles[0];
     }
 
     if (!arguments.count("parameter_bounds")){
@@ -167,6 +683,93 @@ std::map<std::string, std::string> arg_parser(int argc, char** argv){
         arguments["quit"] = "1";
     }
 
+    if (arguments.count("write") && (arguments["write"].empty() || arguments["write"].find_first_not_of("fbc") != std::string::npos)){
+        std::cout << "Invalid write flag " << arguments["write"] << ", use a combination of f, b and c (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+
+    if (arguments.count("rts") && arguments.count("write") && arguments["write"].find_first_of("fc") == std::string::npos){
+        std::cout << "Invalid write flag " << arguments["write"] << " with the rts flag, there is no backward prediction, use f and/or c (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+
+    if (arguments["output_format"] != "csv" && arguments["output_format"] != "npz"){
+        std::cout << "Invalid output format " << arguments["output_format"] << ", use csv or npz (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+
+    if (arguments["multistart"].find_first_not_of("0123456789") != std::string::npos || std::stoi("0" + arguments["multistart"]) < 1){
+        std::cout << "Invalid multistart flag " << arguments["multistart"] << ", use a positive integer (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+
+    if (arguments.count("coarse_to_fine")){
+        std::vector<std::string> levels = split_string_at(arguments["coarse_to_fine"], ",");
+        for (size_t i=0; i<levels.size(); ++i){
+            if (levels[i].find_first_not_of("0123456789") != std::string::npos || std::stoi("0" + levels[i]) < 2){
+                std::cout << "Invalid coarse-to-fine flag " << arguments["coarse_to_fine"] << ", use integers >1, e.g. 8,4,2 (use '-h' for help)!" << std::endl;
+                arguments["quit"] = "1";
+                break;
+            }
+        }
+        if (arguments["multistart"] != "1"){
+            std::cout << "The coarse-to-fine flag can not be combined with multistart (use '-h' for help)!" << std::endl;
+            arguments["quit"] = "1";
+        }
+    }
+
+    if (arguments.count("spsa")){
+        if (arguments["spsa"].find_first_not_of("0123456789") != std::string::npos || std::stoi("0" + arguments["spsa"]) < 1){
+            std::cout << "Invalid spsa flag " << arguments["spsa"] << ", use a positive integer (use '-h' for help)!" << std::endl;
+            arguments["quit"] = "1";
+        }
+        if (arguments["multistart"] != "1"){
+            std::cout << "The spsa flag can not be combined with multistart (use '-h' for help)!" << std::endl;
+            arguments["quit"] = "1";
+        }
+    }
+    if (arguments.count("bayes")){
+        if (arguments["bayes"].find_first_not_of("0123456789") != std::string::npos || std::stoi("0" + arguments["bayes"]) < 1){
+            std::cout << "Invalid bayes flag " << arguments["bayes"] << ", use a positive integer (use '-h' for help)!" << std::endl;
+            arguments["quit"] = "1";
+        }
+        if (arguments["multistart"] != "1"){
+            std::cout << "The bayes flag can not be combined with multistart (use '-h' for help)!" << std::endl;
+            arguments["quit"] = "1";
+        }
+    }
+    if (arguments["bayes_batch"].find_first_not_of("0123456789") != std::string::npos || !arguments["bayes_batch"].size()){
+        std::cout << "Invalid bayes-batch flag " << arguments["bayes_batch"] << ", use a non-negative integer (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+    if (arguments["spsa_batch"].find_first_not_of("0123456789") != std::string::npos || !arguments["spsa_batch"].size()){
+        std::cout << "Invalid spsa-batch flag " << arguments["spsa_batch"] << ", use a non-negative integer (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+
+    if (arguments["cache_size"].find_first_not_of("0123456789") != std::string::npos || !arguments["cache_size"].size()){
+        std::cout << "Invalid cache-size flag " << arguments["cache_size"] << ", use a non-negative integer (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+
+    if (arguments["transform"] != "log" && arguments["transform"] != "none"){
+        std::cout << "Invalid transform flag " << arguments["transform"] << ", use log or none (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+
+    if (!minimizer_algorithms().count(arguments["algorithm"])){
+        std::cout << "Unknown algorithm " << arguments["algorithm"] << " (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+
+    if (arguments.count("predict_columns") && !Prediction_columns().parse(arguments["predict_columns"]))
+        arguments["quit"] = "1";
+
+    if (arguments["predict_every"].find_first_not_of("0123456789") != std::string::npos || std::stoi("0" + arguments["predict_every"]) < 1){
+        std::cout << "Invalid predict-every flag " << arguments["predict_every"] << ", use a positive integer (use '-h' for help)!" << std::endl;
+        arguments["quit"] = "1";
+    }
+
     /* Check if csv file (if parsed) exists, to avoid confusion */
     if(arguments.count("csv_config") && !std::filesystem::exists(arguments["csv_config"])){   
         std::cout << "csv_config flag set, but csv configuration file " << arguments["csv_config"] << " not found!" << std::endl;
@@ -188,16 +791,26 @@ int main(int argc, char** argv){
         return 0;    
     }
 
+    if (arguments.count("query"))
+        return run_query(arguments);
+
     /* get parameter and csv config file */
     Parameter_set params(arguments["parameter_bounds"]);
     std::cout << params << "\n";
 
     CSVconfig config(arguments["csv_config"]);
     std::cout << config << "\n";
+    for (size_t i=0; i<config.filters.size(); ++i){
+        if (Row_filter(config.filters[i]).bad_number){
+            std::cout << "Quit\n";
+            return 0;
+        }
+    }
 
-    /* Read data from input file */
+    /* Read data from input file(s), several files are read in parallel */
     std::cout << "-> Reading" << "\n";
-    std::vector<MOMAdata> cells =  getData(arguments["infile"], 
+    std::vector<std::string> infiles = split_string_at(arguments["infiles"], "\n");
+    std::vector<MOMAdata> cells =  getData(infiles, 
                                             config.time_col,
                                             config.divide_time,
                                             config.length_col,
@@ -205,19 +818,42 @@ int main(int argc, char** argv){
                                             config.fp_col,
                                             config.delm,
                                             config.cell_tags,
-                                            config.parent_tags);
+                                            config.parent_tags,
+                                            config.filters,
+                                            config.time_min,
+                                            config.time_max,
+                                            config.min_points);
     if (!cells.size()){
         std::cout << "Quit\n";
         return 0;    
     }
+    print_data_memory(cells);
+    _likelihood_cache.set_capacity(std::stoul(arguments["cache_size"]));
+    if (arguments.count("disk_cache")){
+        uint64_t fingerprint = data_fingerprint(cells);
+        if (!_likelihood_disk_cache.open(arguments["disk_cache"], fingerprint, _likelihood_model_version)){
+            std::cout << "Quit\n";
+            return 0;
+        }
+        std::cout << "Disk cache: " << arguments["disk_cache"] << ", " << _likelihood_disk_cache.size() 
+                  << " evaluations of this data set (fingerprint " << std::hex << fingerprint << std::dec << ")\n";
+    }
     /* genealogy built via the parent_id (string) given in data file */
     build_cell_genealogy(cells);
 
 
 
     /* run bound_1dscan, minimization and/or prediction... */
-    if (arguments.count("minimize"))
+    if (arguments.count("minimize")){
         run_minimization(cells, params, arguments);
+        if (_minimizer_stop){
+            /* the checkpoint is written, end as terminated by SIGTERM (the default handler is restored) */
+            std::cout << "Stopped by SIGTERM, scan and prediction are skipped" << std::endl;
+            std::raise(SIGTERM);
+        }
+        if (infiles.size() > 1)
+            print_file_likelihoods(params.get_final(), cells, infiles);
+    }
 
     if (arguments.count("scan"))
         run_bound_1dscan(cells, params, arguments);
@@ -225,6 +861,12 @@ int main(int argc, char** argv){
     if (arguments.count("predict"))
         run_prediction(cells, params, arguments);
 
+    if (_likelihood_cache.hits() + _likelihood_cache.misses())
+        std::cout << "Likelihood cache: " << _likelihood_cache.hits() << " hits, " 
+                  << _likelihood_cache.misses() << " misses" << std::endl;
+    if (_likelihood_disk_cache.is_open())
+        std::cout << "Disk cache: " << _likelihood_disk_cache.hits() << " hits, " 
+                  << _likelihood_disk_cache.misses() << " misses" << std::endl;
     std::cout << "Done." << std::endl;
     return 0;
 }
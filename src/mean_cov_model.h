@@ -192,7 +192,7 @@ double cov_qq(double t,double bx,double bg,double bl,double bq,double Cxx,double
 }
 
     
-void mean_cov_model(MOMAdata &cell, 
+void mean_cov_model(Eigen::VectorXd &mean, Eigen::MatrixXd &cov, 
                 double t, double ml, 
                 double gl, double sl2, 
                 double mq, double gq, 
@@ -202,21 +202,21 @@ void mean_cov_model(MOMAdata &cell,
     Eigen::VectorXd nm(4);
     Eigen::MatrixXd nC(4, 4);
 
-    double bx=cell.mean(0);
-    double bg=cell.mean(1);
-    double bl=cell.mean(2); 
-    double bq=cell.mean(3);
-
-    double Cxx=cell.cov(0,0);
-    double Cxg=cell.cov(0,1);
-    double Cxl=cell.cov(0,2);
-    double Cxq=cell.cov(0,3);
-    double Cgg=cell.cov(1,1);
-    double Cgl=cell.cov(1,2);
-    double Cgq=cell.cov(1,3);
-    double Cll=cell.cov(2,2);
-    double Clq=cell.cov(2,3);
-    double Cqq=cell.cov(3,3);
+    double bx=mean(0);
+    double bg=mean(1);
+    double bl=mean(2); 
+    double bq=mean(3);
+
+    double Cxx=cov(0,0);
+    double Cxg=cov(0,1);
+    double Cxl=cov(0,2);
+    double Cxq=cov(0,3);
+    double Cgg=cov(1,1);
+    double Cgl=cov(1,2);
+    double Cgq=cov(1,3);
+    double Cll=cov(2,2);
+    double Clq=cov(2,3);
+    double Cqq=cov(3,3);
 
     // Mean
     nm(0) = mean_x(t,bx,bg,bl,bq,Cxx,Cxg,Cxl,Cxq,Cgg,Cgl,Cgq,Cll,Clq,Cqq,ml,gl,sl2,mq,gq,sq2,b);
@@ -239,6 +239,55 @@ void mean_cov_model(MOMAdata &cell,
     nC(2,2) = cov_ll(t,bx,bg,bl,bq,Cxx,Cxg,Cxl,Cxq,Cgg,Cgl,Cgq,Cll,Clq,Cqq,ml,gl,sl2,mq,gq,sq2,b);
     nC(3,3) = cov_qq(t,bx,bg,bl,bq,Cxx,Cxg,Cxl,Cxq,Cgg,Cgl,Cgq,Cll,Clq,Cqq,ml,gl,sl2,mq,gq,sq2,b);
     
-    cell.mean = nm;
-    cell.cov = nC;
-}
\ No newline at end of file
+    mean = nm;
+    cov = nC;
+}
+
+void mean_cov_model(MOMAdata &cell, 
+                double t, double ml, 
+                double gl, double sl2, 
+                double mq, double gq, 
+                double sq2, double b){
+    /* updates the (forward) state of the cell */
+    mean_cov_model(cell.mean, cell.cov, t, ml, gl, sl2, mq, gq, sq2, b);
+}
+
+Eigen::Matrix4d mean_jacobian(const Eigen::VectorXd &mean, const Eigen::MatrixXd &cov, 
+                double t, double ml, 
+                double gl, double sl2, 
+                double mq, double gq, 
+                double sq2, double b){
+    /*
+    * Jacobian of the propagated mean (mean_x, mean_g, mean_l, mean_q) w.r.t. the mean before the time step.
+    * The propagated mean is an expectation over the gaussian state, thus (Stein's lemma) the 
+    * cross-covariance of the states before and after the time step is cov * jacobian^T
+    */
+    double bx=mean(0);
+    double bl=mean(2); 
+    double bq=mean(3);
+
+    double Cxx=cov(0,0);
+    double Cxl=cov(0,2);
+    double Cxq=cov(0,3);
+    double Cll=cov(2,2);
+    double Clq=cov(2,3);
+
+    // arguments of the integrals in mean_g, d/db of the n-th integral is the (n+1)-th, d/dc is the integral itself
+    double a = Cll/2.;
+    double b0 = b+bl+Cxl;
+    double b1 = b+bl+Cxl-gq;
+    double c = bx+Cxx/2.-b*t;
+
+    Eigen::Matrix4d J = Eigen::Matrix4d::Zero();
+    J(0,0) = 1;
+    J(0,2) = (1-exp(-gl*t))/gl;
+
+    J(1,1) = exp(-b*t);
+    J(1,0) = Clq*onetauint(a,b1,c,t) + mq*zerotauint(a,b0,c,t) + (bq+Cxq-mq)*zerotauint(a,b1,c,t);
+    J(1,2) = Clq*twotauint(a,b1,c,t) + mq*onetauint(a,b0,c,t) + (bq+Cxq-mq)*onetauint(a,b1,c,t);
+    J(1,3) = zerotauint(a,b1,c,t);
+
+    J(2,2) = exp(-gl*t);
+    J(3,3) = exp(-gq*t);
+    return J;
+}
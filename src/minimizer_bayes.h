@@ -0,0 +1,274 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cmath>
+
+#include <Eigen/Dense>
+
+#include "thread_pool.h"
+#include "minimizer_nlopt.h"
+
+#ifndef MINIMIZER_BAYES_H
+#define MINIMIZER_BAYES_H
+
+// ============================================================================= //
+// GAUSSIAN PROCESS
+// ============================================================================= //
+
+class Gaussian_process{
+    /*
+    * Gaussian process regression with a squared exponential kernel (length scale l, inputs in the
+    * unit cube) of the standardized values, l is chosen from a grid by the marginal likelihood
+    */
+public:
+    void add(const Eigen::VectorXd &x, double y){
+        X.push_back(x);
+        Y.push_back(y);
+    }
+
+    size_t size() const{
+        return X.size();
+    }
+
+    double length_scale() const{
+        return length;
+    }
+
+    void fit(){
+        /* fit with the length scale of the grid that maximizes the marginal likelihood */
+        double best_lml = -HUGE_VAL;
+        double best_length = length;
+        for (double l : {0.05, 0.1, 0.2, 0.3, 0.5, 0.8, 1.2}){
+            double lml = fit(l);
+            if (lml > best_lml){
+                best_lml = lml;
+                best_length = l;
+            }
+        }
+        fit(best_length);
+    }
+
+    double fit(double l){
+        /* fit with the length scale l, returns the log marginal likelihood */
+        length = l;
+        size_t m = X.size();
+        y_mean = 0;
+        for (size_t i=0; i<m; ++i)
+            y_mean += Y[i] / m;
+        y_sd = 0;
+        for (size_t i=0; i<m; ++i)
+            y_sd += (Y[i] - y_mean) * (Y[i] - y_mean) / m;
+        y_sd = y_sd > 0 ? std::sqrt(y_sd) : 1;
+
+        Eigen::MatrixXd K(m, m);
+        Eigen::VectorXd y(m);
+        for (size_t i=0; i<m; ++i){
+            y(i) = (Y[i] - y_mean) / y_sd;
+            for (size_t j=0; j<=i; ++j)
+                K(i, j) = K(j, i) = kernel(X[i], X[j]);
+            K(i, i) += noise;
+        }
+        llt.compute(K);
+        alpha = llt.solve(y);
+        return -0.5 * y.dot(alpha) - Eigen::MatrixXd(llt.matrixL()).diagonal().array().log().sum();
+    }
+
+    void predict(const Eigen::VectorXd &x, double &mean, double &sd) const{
+        size_t m = X.size();
+        Eigen::VectorXd k(m);
+        for (size_t i=0; i<m; ++i)
+            k(i) = kernel(x, X[i]);
+        Eigen::VectorXd v = llt.matrixL().solve(k);
+        mean = y_mean + y_sd * k.dot(alpha);
+        sd = y_sd * std::sqrt(std::max(1 + noise - v.squaredNorm(), 1e-12));
+    }
+
+private:
+    std::vector<Eigen::VectorXd> X;
+    std::vector<double> Y;
+    double length = 0.2;
+    double noise = 1e-6;
+    double y_mean = 0;
+    double y_sd = 1;
+    Eigen::LLT<Eigen::MatrixXd> llt;
+    Eigen::VectorXd alpha;
+
+    double kernel(const Eigen::VectorXd &a, const Eigen::VectorXd &b) const{
+        return std::exp(-(a - b).squaredNorm() / (2 * length * length));
+    }
+};
+
+
+double expected_improvement(double mean, double sd, double best){
+    /* expected improvement of a minimization over the best value for a normal prediction */
+    double z = (best - mean) / sd;
+    return (best - mean) * 0.5 * std::erfc(-z / std::sqrt(2)) + sd * std::exp(-0.5 * z * z) / std::sqrt(2 * M_PI);
+}
+
+// ============================================================================= //
+// BAYESIAN OPTIMIZATION
+// ============================================================================= //
+
+Minimizer_result minimize_bayes(double (*target_func)(const std::vector<double> &x, std::vector<double> &grad, void *p),
+                                void *data,
+                                Parameter_set &params,
+                                int evaluations,
+                                size_t batch,
+                                Thread_pool &pool,
+                                const std::vector<double> &init){
+    /*
+    * Bayesian optimization within the bounds of the non-fixed parameters (which all need bounds):
+    * a Gaussian process is fitted to all evaluated points (in the unit cube of the bounds) and the next
+    * batch of points maximizes the expected improvement, each point of a batch assumes the predictions
+    * at the previous ones ("kriging believer"). The points of a batch are evaluated concurrently on
+    * the pool, thus target_func has to allow concurrent calls with data.
+    * Starts with the init point and a latin hypercube of 2n+1 points (n non-fixed parameters) and
+    * stops after the given number of evaluations or when the largest expected improvement is below 0.1
+    * (then a local minimization from the best point is more efficient)
+    */
+    Minimizer_result result;
+    std::vector<int> free_idx = params.non_fixed();
+    size_t n = free_idx.size();
+    for (size_t i=0; i<n; ++i){
+        if (!params.all[free_idx[i]].bound){
+            result.status = "error: the Bayesian optimization requires bounds for all non-fixed parameters, "
+                            + params.all[free_idx[i]].name + " is free";
+            return result;
+        }
+    }
+    result.params_vec = init;
+    if (n == 0 || evaluations < 1){
+        result.success = true;
+        result.status = "nothing to minimize";
+        return result;
+    }
+
+    auto to_full = [&](const Eigen::VectorXd &u){
+        std::vector<double> full = init;
+        for (size_t i=0; i<n; ++i){
+            const Parameter &param = params.all[free_idx[i]];
+            full[free_idx[i]] = param.lower + u(i) * (param.upper - param.lower);
+        }
+        return full;
+    };
+    auto to_unit = [&](const std::vector<double> &full){
+        Eigen::VectorXd u(n);
+        for (size_t i=0; i<n; ++i){
+            const Parameter &param = params.all[free_idx[i]];
+            u(i) = std::max(0., std::min((full[free_idx[i]] - param.lower) / (param.upper - param.lower), 1.));
+        }
+        return u;
+    };
+
+    // all evaluations, failed evaluations (NaN) enter the surrogate with the worst value
+    std::vector<Eigen::VectorXd> points;
+    std::vector<double> values;
+    double best_f = HUGE_VAL;
+    double worst_f = -HUGE_VAL;
+    size_t best = 0;
+
+    auto evaluate = [&](const std::vector<Eigen::VectorXd> &us){
+        std::vector<double> f(us.size());
+        for (size_t i=0; i<us.size(); ++i){
+            pool.submit([&, i]{
+                std::vector<double> grad;
+                f[i] = target_func(to_full(us[i]), grad, data);
+            });
+        }
+        pool.wait();
+        for (size_t i=0; i<us.size(); ++i){
+            if (points.empty())
+                result.init_f = f[i];
+            points.push_back(us[i]);
+            values.push_back(f[i]);
+            if (!is_finite(f[i]))
+                continue;
+            if (f[i] < best_f){
+                best_f = f[i];
+                best = points.size() - 1;
+            }
+            worst_f = std::max(worst_f, f[i]);
+        }
+    };
+
+    // initial design
+    std::vector<std::vector<double>> design = latin_hypercube(params, 2*n + 1);
+    std::vector<Eigen::VectorXd> us = {to_unit(init)};
+    for (size_t k=0; k<design.size() && us.size() < (size_t) evaluations; ++k)
+        us.push_back(to_unit(design[k]));
+    evaluate(us);
+
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> normal(0, 1);
+    result.status = "evaluations done";
+    while (points.size() < (size_t) evaluations && !_minimizer_stop){
+        if (!is_finite(best_f)){
+            result.status = "failed: no finite value";
+            break;
+        }
+        Gaussian_process gp;
+        for (size_t i=0; i<points.size(); ++i)
+            gp.add(points[i], is_finite(values[i]) ? values[i] : worst_f);
+        gp.fit();
+
+        // candidates: uniform in the cube and around the best point
+        std::vector<Eigen::VectorXd> candidates;
+        for (size_t k=0; k<1000; ++k){
+            Eigen::VectorXd u(n);
+            for (size_t i=0; i<n; ++i)
+                u(i) = uniform(generator);
+            candidates.push_back(u);
+        }
+        for (double scale : {0.1, 0.02}){
+            for (size_t k=0; k<500; ++k){
+                Eigen::VectorXd u = points[best];
+                for (size_t i=0; i<n; ++i)
+                    u(i) = std::max(0., std::min(u(i) + scale * normal(generator), 1.));
+                candidates.push_back(u);
+            }
+        }
+
+        // batch by the kriging believer
+        us.clear();
+        double max_ei = 0;
+        size_t q = std::min(batch, evaluations - points.size());
+        for (size_t j=0; j<q; ++j){
+            double best_ei = -1, best_mean = 0;
+            size_t c_best = 0;
+            for (size_t c=0; c<candidates.size(); ++c){
+                double mean, sd;
+                gp.predict(candidates[c], mean, sd);
+                double ei = expected_improvement(mean, sd, best_f);
+                if (ei > best_ei){
+                    best_ei = ei;
+                    best_mean = mean;
+                    c_best = c;
+                }
+            }
+            if (j == 0)
+                max_ei = best_ei;
+            us.push_back(candidates[c_best]);
+            candidates.erase(candidates.begin() + c_best);
+            if (j+1 < q){
+                gp.add(us.back(), best_mean);
+                gp.fit(gp.length_scale());
+            }
+        }
+        if (max_ei < 0.1){
+            result.status = "converged (expected improvement < 0.1)";
+            break;
+        }
+        evaluate(us);
+    }
+    if (_minimizer_stop)
+        result.status = "stopped by signal";
+
+    result.params_vec = to_full(points[best]);
+    result.minf = best_f;
+    result.evaluations = points.size();
+    result.success = is_finite(best_f);
+    return result;
+}
+
+#endif
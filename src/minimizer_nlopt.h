@@ -1,11 +1,22 @@
 #include <iostream>
 #include <vector>
+#include <map>
 #include <iomanip> 
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <csignal>
+#include <atomic>
 
 #include <nlopt.hpp>
 
 #include "Parameters.h"
 
+#ifndef MINIMIZER_NLOPT_H
+#define MINIMIZER_NLOPT_H
+
 
 
 double myvfunc(const std::vector<double> &parameters, std::vector<double> &grad, void *p){
@@ -18,59 +29,533 @@ double myvfunc(const std::vector<double> &parameters, std::vector<double> &grad,
     return pow(sum, 2);
 }
 
-void minimize_wrapper(double (*target_func)(const std::vector<double> &x, std::vector<double> &grad, void *p),
-                        std::vector<MOMAdata> &cells,
-                        Parameter_set &params, 
-                        double relative_tol){
+struct Minimizer_algorithm{
+    nlopt::algorithm algorithm;
+    char type;  // l(ocal, derivative-free), d(erivative based, local) or g(lobal, requires bounds)
+};
+
+std::map<std::string, Minimizer_algorithm> minimizer_algorithms(){
+    /* algorithms that can be chosen with --algorithm */
+    return {{"cobyla",      {nlopt::LN_COBYLA, 'l'}},
+            {"bobyqa",      {nlopt::LN_BOBYQA, 'l'}},
+            {"newuoa",      {nlopt::LN_NEWUOA_BOUND, 'l'}},
+            {"neldermead",  {nlopt::LN_NELDERMEAD, 'l'}},
+            {"sbplx",       {nlopt::LN_SBPLX, 'l'}},
+            {"praxis",      {nlopt::LN_PRAXIS, 'l'}},
+            {"lbfgs",       {nlopt::LD_LBFGS, 'd'}},
+            {"slsqp",       {nlopt::LD_SLSQP, 'd'}},
+            {"mma",         {nlopt::LD_MMA, 'd'}},
+            {"ccsaq",       {nlopt::LD_CCSAQ, 'd'}},
+            {"tnewton",     {nlopt::LD_TNEWTON_PRECOND_RESTART, 'd'}},
+            {"direct",      {nlopt::GN_DIRECT_L, 'g'}},
+            {"crs",         {nlopt::GN_CRS2_LM, 'g'}},
+            {"isres",       {nlopt::GN_ISRES, 'g'}},
+            {"esch",        {nlopt::GN_ESCH, 'g'}},
+            {"mlsl",        {nlopt::G_MLSL_LDS, 'g'}}};
+}
+
+
+struct Minimizer_settings{
+    /*
+    * settings of the minimization, a value of 0 means that the criterion is not used,
+    * the population size (0: default of nlopt) is used by crs, isres, esch and mlsl
+    */
+    std::string algorithm = "cobyla";
+    double xtol_rel = 1e-2;
+    double ftol_rel = 0;
+    double ftol_abs = 0;
+    int maxeval = 0;
+    double maxtime = 0;
+    unsigned population = 0;
+    std::string transform = "log";  // coordinates of the optimizer: log or none, see Minimizer_context
 
-    // set parameter space 
-    std::vector<double> lower_bounds(params.all.size());
-    std::vector<double> upper_bounds(params.all.size());
-    std::vector<double> steps(params.all.size());
+    // the best point is written to the checkpoint file (if set) every checkpoint_every evaluations, 
+    // on SIGUSR1/SIGTERM and at the end, resumed_evaluations are the evaluations before a resume
+    std::string checkpoint;
+    int checkpoint_every = 10;
+    int resumed_evaluations = 0;
 
-    std::vector<double> parameter_state(params.all.size());
+    std::string str() const{
+        std::stringstream ss;
+        ss << "algorithm=" << algorithm << ",xtol_rel=" << xtol_rel << ",ftol_rel=" << ftol_rel 
+           << ",ftol_abs=" << ftol_abs << ",maxeval=" << maxeval << ",maxtime=" << maxtime 
+           << ",population=" << population << ",transform=" << transform;
+        return ss.str();
+    }
+};
+
+
+// set by the signal handler: SIGTERM stops all minimizations, each SIGUSR1 requests a checkpoint
+std::atomic<int> _minimizer_stop(0);
+std::atomic<int> _minimizer_flush(0);
+
+void minimizer_signal_handler(int signal){
+    if (signal == SIGTERM)
+        _minimizer_stop = 1;
+    else
+        ++_minimizer_flush;
+}
+
+void install_minimizer_signal_handlers(){
+    std::signal(SIGTERM, minimizer_signal_handler);
+    std::signal(SIGUSR1, minimizer_signal_handler);
+}
 
+void restore_default_signal_handlers(){
+    /* after the minimization, later stages (scan, prediction) are terminated by SIGTERM again */
+    std::signal(SIGTERM, SIG_DFL);
+    std::signal(SIGUSR1, SIG_DFL);
+}
+
+
+struct Minimizer_context{
+    /*
+    * The optimizer only sees the non-fixed parameters (x), the full parameter vector 
+    * (params_vec, in the order of Parameter_set::all) that is passed to the target function 
+    * holds the values of the fixed parameters and is filled with x before each evaluation.
+    * With transforms, x are not the natural values but 
+    *   l: log(p) for free variances and rates 
+    *   s: scaled logit log((p - lower)/(upper - p)) for bound parameters
+    *   n: p (no transform)
+    * such that all coordinates have a similar scale, the target function always gets natural values
+    */
+    double (*target_func)(const std::vector<double> &x, std::vector<double> &grad, void *p);
+    void *data;
+    std::vector<int> free_idx;
+    std::vector<double> params_vec;
+
+    std::vector<char> transform;
+    std::vector<double> bound_lower;
+    std::vector<double> bound_upper;
+
+    // the gradient for derivative based algorithms is calculated numerically (central differences 
+    // with the step h, one-sided at the bounds)
+    bool numerical_gradient = false;
+    std::vector<double> h;
+    std::vector<double> lower;
+    std::vector<double> upper;
+
+    // evaluations of the target function (including those of the numerical gradient) and their 
+    // maximal number (0: no limit), first and best value and the best point (full vector)
+    int evaluations = 0;
+    int maxeval = 0;
+    bool maxeval_reached = false;
+    double first_f = NAN;
+    double best_f = HUGE_VAL;
+    std::vector<double> best_params_vec;
+
+    // checkpoints, see Minimizer_settings
+    std::string checkpoint;
+    int checkpoint_every = 0;
+    int resumed_evaluations = 0;
+    int flushes = 0;
+    std::vector<std::string> names;
+
+    double to_natural(size_t i, double x) const{
+        if (transform.empty() || transform[i] == 'n')
+            return x;
+        if (transform[i] == 'l')
+            return std::exp(x);
+        return bound_lower[i] + (bound_upper[i] - bound_lower[i]) / (1 + std::exp(-x));
+    }
+
+    double to_optimizer(size_t i, double p) const{
+        if (transform.empty() || transform[i] == 'n')
+            return p;
+        if (transform[i] == 'l')
+            return std::log(p);
+        // keep values at (or beyond) the bounds finite
+        double y = std::log((p - bound_lower[i]) / (bound_upper[i] - p));
+        return is_nan(y) ? (p < bound_lower[i] ? -logit_max : logit_max) : std::max(-logit_max, std::min(y, logit_max));
+    }
+
+    std::vector<double> to_full(const std::vector<double> &x) const{
+        std::vector<double> full = params_vec;
+        for (size_t i=0; i<free_idx.size(); ++i)
+            full[free_idx[i]] = to_natural(i, x[i]);
+        return full;
+    }
+
+    std::vector<double> to_reduced(const std::vector<double> &full) const{
+        std::vector<double> x(free_idx.size());
+        for (size_t i=0; i<free_idx.size(); ++i)
+            x[i] = to_optimizer(i, full[free_idx[i]]);
+        return x;
+    }
+
+    static constexpr double logit_max = 30;
+};
+
+
+void write_checkpoint(std::string filename, const std::vector<std::string> &names, const std::vector<double> &params_vec,
+                      double f, int evaluations, std::string status){
+    /* 
+    * writes the point (full vector) and the number of evaluations, the file is replaced 
+    * only when it is complete (rename), such that a kill during writing keeps the previous checkpoint
+    */
+    if (!params_vec.size())
+        return;
+    std::string tmp = filename + ".tmp";
+    std::ofstream file(tmp);
+    file << "# checkpoint of the minimization (" << status << "), continue with --resume\n"
+         << "evaluations = " << evaluations << "\n"
+         << std::setprecision(17) << "minimum = " << f << "\n";
+    for (size_t i=0; i<names.size(); ++i)
+        file << names[i] << " = " << params_vec[i] << "\n";
+    file.close();
+    if (file.fail() || std::rename(tmp.c_str(), filename.c_str()) != 0)
+        std::cerr << "Could not write checkpoint " << filename << std::endl;
+}
+
+
+void write_checkpoint(const Minimizer_context &context, std::string status){
+    /* best point of the minimization of the context */
+    write_checkpoint(context.checkpoint, context.names, context.best_params_vec, context.best_f, 
+                     context.resumed_evaluations + context.evaluations, status);
+}
+
+
+bool read_checkpoint(std::string filename, const Parameter_set &params, std::vector<double> &params_vec, int &evaluations){
+    /* reads the point and the evaluations of a checkpoint, returns false if there is no (complete) checkpoint */
+    std::ifstream file(filename);
+    if (!file.is_open())
+        return false;
+    std::map<std::string, double> values;
+    std::string line;
+    while (getline(file, line)){
+        std::vector<std::string> parts = split_string_at(line, "=");
+        if (line[0] != '#' && parts.size() == 2)
+            values[trim(parts[0])] = std::stod(parts[1]);
+    }
+    if (!values.count("evaluations"))
+        return false;
+    params_vec.resize(params.all.size());
     for (size_t i=0; i<params.all.size(); ++i){
-        parameter_state[i] = params.all[i].init;
-        if (params.all[i].fixed){
-            steps[i] = 1; // will not be used anyway, but needs to be non-zero
-            lower_bounds[i] = params.all[i].init;
-            upper_bounds[i] = params.all[i].init;
-        } else if (params.all[i].bound){
-            steps[i] = params.all[i].step;
-            lower_bounds[i] = params.all[i].lower;
-            upper_bounds[i] = params.all[i].upper;
+        if (!values.count(params.all[i].name))
+            return false;
+        params_vec[i] = values[params.all[i].name];
+    }
+    evaluations = values["evaluations"];
+    return true;
+}
+
+
+double evaluate_reduced(const std::vector<double> &x, std::vector<double> &full_grad, Minimizer_context *context){
+    /* 
+    * single evaluation of the target function for the non-fixed parameters x, stops the minimization 
+    * (forced_stop) on SIGTERM or if the maximal number of evaluations is reached 
+    */
+    if (_minimizer_stop)
+        throw nlopt::forced_stop();
+    if (context->maxeval > 0 && context->evaluations >= context->maxeval){
+        context->maxeval_reached = true;
+        throw nlopt::forced_stop();
+    }
+
+    std::vector<double> full = context->to_full(x);
+    double f = context->target_func(full, full_grad, context->data);
+
+    if (context->evaluations++ == 0)
+        context->first_f = f;
+    if (f < context->best_f){
+        context->best_f = f;
+        context->best_params_vec = full;
+    }
+    if (context->checkpoint.size()){
+        int flushes = _minimizer_flush;
+        if (flushes != context->flushes || context->evaluations % context->checkpoint_every == 0){
+            context->flushes = flushes;
+            write_checkpoint(*context, "running");
+        }
+    }
+    return f;
+}
+
+
+double reduced_target(const std::vector<double> &x, std::vector<double> &grad, void *p){
+    /* evaluates the target function of the context (p) for the non-fixed parameters x */
+    Minimizer_context *context = (Minimizer_context *) p;
+    std::vector<double> full_grad(grad.size() && !context->numerical_gradient ? context->params_vec.size() : 0);
+    double f = evaluate_reduced(x, full_grad, context);
+
+    if (context->numerical_gradient){
+        std::vector<double> no_grad;
+        for (size_t i=0; i<grad.size(); ++i){
+            std::vector<double> x_plus = x, x_minus = x;
+            x_plus[i] = std::min(x[i] + context->h[i], context->upper[i]);
+            x_minus[i] = std::max(x[i] - context->h[i], context->lower[i]);
+            grad[i] = (evaluate_reduced(x_plus, no_grad, context) - evaluate_reduced(x_minus, no_grad, context)) 
+                        / (x_plus[i] - x_minus[i]);
+        }
+        return f;
+    }
+    for (size_t i=0; i<grad.size(); ++i)
+        grad[i] = full_grad[context->free_idx[i]];
+    return f;
+}
+
+
+struct Minimizer_result{
+    std::vector<double> params_vec; // final (or if failed best) parameters, full vector
+    double init_f = NAN;            // target function at the first and at the final point
+    double minf = NAN;
+    int evaluations = 0;
+    bool success = false;
+    std::string status;
+};
+
+
+std::string minimizer_status(nlopt::result result){
+    switch (result){
+        case nlopt::SUCCESS: return "success";
+        case nlopt::STOPVAL_REACHED: return "stopval reached";
+        case nlopt::FTOL_REACHED: return "ftol reached";
+        case nlopt::XTOL_REACHED: return "xtol reached";
+        case nlopt::MAXEVAL_REACHED: return "maxeval reached";
+        case nlopt::MAXTIME_REACHED: return "maxtime reached";
+        default: return "failed";
+    }
+}
+
+
+void setup_context(Minimizer_context &context, 
+                   double (*target_func)(const std::vector<double> &x, std::vector<double> &grad, void *p),
+                   void *data,
+                   Parameter_set &params, 
+                   const Minimizer_settings &settings,
+                   const std::vector<double> &init,
+                   std::vector<double> &lower_bounds, std::vector<double> &upper_bounds, 
+                   std::vector<double> &steps, std::vector<double> &xtol){
+    /* 
+    * sets up the context for a minimization starting at init (full vector) and the bounds, initial steps 
+    * and tolerances of the non-fixed parameters in the coordinates of the optimizer
+    */
+    context.target_func = target_func;
+    context.data = data; // is type casted to void pointer
+    context.free_idx = params.non_fixed();
+    context.params_vec = init;
+    context.checkpoint = settings.checkpoint;
+    context.checkpoint_every = std::max(settings.checkpoint_every, 1);
+    context.resumed_evaluations = settings.resumed_evaluations;
+    context.flushes = _minimizer_flush;
+    for (size_t i=0; i<params.all.size(); ++i)
+        context.names.push_back(params.all[i].name);
+
+    // set parameter space of the non-fixed parameters
+    size_t n = context.free_idx.size();
+    lower_bounds.resize(n);
+    upper_bounds.resize(n);
+    steps.resize(n);
+    xtol.resize(n);
+
+    for (size_t i=0; i<n; ++i){
+        const Parameter &param = params.all[context.free_idx[i]];
+        double value = init[context.free_idx[i]];
+        steps[i] = param.step;
+        context.bound_lower.push_back(param.bound ? param.lower : -HUGE_VAL);
+        context.bound_upper.push_back(param.bound ? param.upper : HUGE_VAL);
+        if (settings.transform == "log" && param.bound && param.lower < param.upper)
+            context.transform.push_back('s');
+        else if (settings.transform == "log" && !param.bound && param.positive && value > 0)
+            context.transform.push_back('l');
+        else 
+            context.transform.push_back('n');
+
+        if (context.transform[i] == 's'){
+            lower_bounds[i] = -context.logit_max;
+            upper_bounds[i] = context.logit_max;
+        } else {
+            lower_bounds[i] = context.bound_lower[i];
+            upper_bounds[i] = context.bound_upper[i];
+        }
+
+        if (context.transform[i] == 'n'){
+            xtol[i] = settings.xtol_rel * (value != 0 ? std::abs(value) : steps[i]);
         } else {
-            steps[i] = params.all[i].step;
-            lower_bounds[i] = -HUGE_VAL;
-            upper_bounds[i] = HUGE_VAL;
+            // the step in the transformed coordinate (derivative at the starting point), at most 1,
+            // the tolerance is the relative change of p (log) or of (p - lower)/(upper - p) (scaled logit)
+            double y = context.to_optimizer(i, value);
+            double dy = std::abs(context.to_optimizer(i, value + steps[i]) - y);
+            steps[i] = is_finite(dy) && dy > 0 ? std::min(dy, 1.) : 1.;
+            xtol[i] = settings.xtol_rel;
+        }
+    }
+}
+
+
+Minimizer_result minimize(double (*target_func)(const std::vector<double> &x, std::vector<double> &grad, void *p),
+                        void *data,
+                        Parameter_set &params, 
+                        const Minimizer_settings &settings,
+                        const std::vector<double> &init){
+    /*
+    * minimizes target_func (called with data) over the non-fixed parameters starting at init (full vector),
+    * does not print or change params, such that several minimizations can run concurrently
+    */
+    Minimizer_result minimizer_result;
+
+    Minimizer_context context;
+    std::vector<double> lower_bounds, upper_bounds, steps, xtol;
+    setup_context(context, target_func, data, params, settings, init, lower_bounds, upper_bounds, steps, xtol);
+    size_t n = context.free_idx.size();
+
+    std::vector<double> parameter_state = context.to_reduced(context.params_vec);
+
+    Minimizer_algorithm algorithm = minimizer_algorithms()[settings.algorithm];
+    if (algorithm.type == 'g'){
+        for (size_t i=0; i<n; ++i){
+            if (!is_finite(lower_bounds[i]) || !is_finite(upper_bounds[i])){
+                minimizer_result.status = "error: the global algorithm " + settings.algorithm + " requires bounds for all non-fixed parameters, " 
+                                            + params.all[context.free_idx[i]].name + " is free";
+                return minimizer_result;
+            }
         }
     }
+    if (algorithm.type == 'd'){
+        context.numerical_gradient = true;
+        context.lower = lower_bounds;
+        context.upper = upper_bounds;
+        for (size_t i=0; i<n; ++i)
+            context.h.push_back(1e-3 * steps[i]);
+    }
+
+    if (n == 0){
+        // a stop (SIGTERM) during the single evaluation must not escape, e.g. from a thread of the multistart
+        try{
+            std::vector<double> grad;
+            minimizer_result.minf = reduced_target(parameter_state, grad, &context);
+            minimizer_result.init_f = minimizer_result.minf;
+            minimizer_result.params_vec = context.params_vec;
+            minimizer_result.evaluations = 1;
+            minimizer_result.success = true;
+            minimizer_result.status = "all parameters fixed";
+        }
+        catch(nlopt::forced_stop &e) {
+            minimizer_result.status = context.maxeval_reached ? "maxeval reached" : "stopped by signal";
+        }
+        return minimizer_result;
+    }
 
     // set up optimizer
-    nlopt::opt opt(nlopt::LN_COBYLA, params.all.size());
+    nlopt::opt opt(algorithm.algorithm, n);
 
     opt.set_lower_bounds(lower_bounds);
     opt.set_upper_bounds(upper_bounds);
     opt.set_initial_step(steps);
-    opt.set_xtol_rel(relative_tol);
+    if (settings.transform == "log"){
+        // transformed coordinates are compared by absolute differences, which are relative changes of the parameters
+        opt.set_xtol_abs(xtol);
+    } else {
+        opt.set_xtol_rel(settings.xtol_rel);
+    }
+    opt.set_ftol_rel(settings.ftol_rel);
+    opt.set_ftol_abs(settings.ftol_abs);
+    opt.set_maxeval(settings.maxeval);
+    opt.set_maxtime(settings.maxtime);
+    if (settings.population > 0)
+        opt.set_population(settings.population);
 
-    std::vector<MOMAdata *> p_roots = get_roots(cells);
+    if (algorithm.algorithm == nlopt::G_MLSL_LDS){
+        // local searches of the multi-level single-linkage
+        nlopt::opt local(nlopt::LN_BOBYQA, n);
+        if (settings.transform == "log")
+            local.set_xtol_abs(xtol);
+        else
+            local.set_xtol_rel(settings.xtol_rel);
+        local.set_ftol_rel(settings.ftol_rel);
+        local.set_ftol_abs(settings.ftol_abs);
+        opt.set_local_optimizer(local);
+    }
 
-    opt.set_min_objective(target_func, &p_roots); // is type casted to void pointer
+    opt.set_min_objective(reduced_target, &context);
+    // nlopt only counts its own calls, the context also counts the evaluations of the numerical gradient
+    context.maxeval = settings.maxeval;
 
     double minf;
     // actual minimization
     try{
-        opt.optimize(parameter_state, minf);
-        std::cout << "Found minimum: log likelihood " << std::setprecision(10) << minf << std::endl;
+        nlopt::result result = opt.optimize(parameter_state, minf);
+        minimizer_result.params_vec = context.to_full(parameter_state);
+        minimizer_result.minf = minf;
+        minimizer_result.success = true;
+        minimizer_result.status = minimizer_status(result);
+    }
+    catch(nlopt::forced_stop &e) {
+        minimizer_result.params_vec = context.best_params_vec;
+        minimizer_result.minf = context.best_f;
+        minimizer_result.success = context.maxeval_reached;
+        minimizer_result.status = context.maxeval_reached ? "maxeval reached" : "stopped by signal";
+    }
+    catch(std::exception &e) {
+        minimizer_result.params_vec = context.best_params_vec;
+        minimizer_result.minf = context.best_f;
+        minimizer_result.status = std::string("failed: ") + e.what();
+    }
+    if (context.checkpoint.size())
+        write_checkpoint(context, minimizer_result.status);
+    minimizer_result.init_f = context.first_f;
+    minimizer_result.evaluations = context.evaluations;
+    return minimizer_result;
+}
 
-        // save final value for each parameter
-        params.set_final(parameter_state);
-        std::cout << params << std::endl;
 
+void minimize_wrapper(double (*target_func)(const std::vector<double> &x, std::vector<double> &grad, void *p),
+                        void *data,
+                        Parameter_set &params, 
+                        const Minimizer_settings &settings,
+                        std::vector<double> init={}){
+    /* single minimization starting at init (default: init values of the parameters), the result is saved in params */
+    if (!init.size())
+        init = params.get_init();
+    Minimizer_result result = minimize(target_func, data, params, settings, init);
+
+    if (result.status == "stopped by signal" && result.params_vec.size()){
+        std::cout << "Stopped by signal after " << result.evaluations << " evaluations, best log likelihood " 
+                  << std::setprecision(10) << result.minf << std::endl;
+        if (settings.checkpoint.size())
+            std::cout << "Checkpoint: " << settings.checkpoint << std::endl;
+        params.set_final(result.params_vec);
+        std::cout << params << std::endl;
+        return;
     }
-    catch(std::exception &e) {
-        std::cout << "Nlopt failed: " << e.what() << std::endl;
+    if (!result.success){
+        std::cout << "Nlopt " << result.status << std::endl;
+        return;
     }
+    std::cout << "Found minimum: log likelihood " << std::setprecision(10) << result.minf << std::endl;
+    if (result.status == "maxeval reached")
+        std::cout << "Stopped after maxeval=" << settings.maxeval << " evaluations" << std::endl;
+    else if (result.status == "maxtime reached")
+        std::cout << "Stopped after maxtime=" << settings.maxtime << " seconds" << std::endl;
+
+    // save final value for each parameter
+    params.set_final(result.params_vec);
+    std::cout << params << std::endl;
 }
+
+
+std::vector<std::vector<double>> latin_hypercube(Parameter_set &params, size_t n, unsigned seed=1){
+    /*
+    * n parameter vectors (full vectors) from a latin hypercube within the bounds of the bound parameters: 
+    * the range of each bound parameter is divided into n intervals of equal size and each interval 
+    * is used by exactly one of the points, free and fixed parameters are set to their init values
+    */
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<std::vector<double>> points(n, params.get_init());
+    for (size_t i=0; i<params.all.size(); ++i){
+        if (!params.all[i].bound)
+            continue;
+        std::vector<size_t> intervals(n);
+        for (size_t k=0; k<n; ++k)
+            intervals[k] = k;
+        std::shuffle(intervals.begin(), intervals.end(), generator);
+        for (size_t k=0; k<n; ++k){
+            double u = (intervals[k] + uniform(generator)) / n;
+            points[k][i] = params.all[i].lower + u * (params.all[i].upper - params.all[i].lower);
+        }
+    }
+    return points;
+}
+
+#endif
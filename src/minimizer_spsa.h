@@ -0,0 +1,117 @@
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <random>
+#include <cmath>
+
+#include "minimizer_nlopt.h"
+
+#ifndef MINIMIZER_SPSA_H
+#define MINIMIZER_SPSA_H
+
+// ============================================================================= //
+// SPSA
+// ============================================================================= //
+
+Minimizer_result minimize_spsa(double (*target_func)(const std::vector<double> &x, std::vector<double> &grad, void *p),
+                               void *data,
+                               std::function<void(int)> next_batch,
+                               Parameter_set &params,
+                               const Minimizer_settings &settings,
+                               int iterations,
+                               const std::vector<double> &init){
+    /*
+    * Simultaneous perturbation stochastic approximation (Spall): each iteration k estimates the gradient
+    * from two evaluations at x +- c_k*delta, delta is randomly +-1 for each coordinate (scaled by the
+    * initial step). Both evaluations use the same batch, which is set by next_batch(k) before, such that
+    * a noisy target (e.g. random batches of the data) is tolerated.
+    * Works in the (transformed) coordinates of Minimizer_context with the standard gains
+    *   a_k = a/(k+1+A)^0.602, c_k = 1/(k+1)^0.101 (in units of the steps), A = iterations/10
+    * where a is calibrated at the starting point such that the first steps are about 10 initial steps
+    */
+    Minimizer_result result;
+    Minimizer_context context;
+    std::vector<double> lower, upper, steps, xtol;
+    setup_context(context, target_func, data, params, settings, init, lower, upper, steps, xtol);
+    size_t n = context.free_idx.size();
+    std::vector<double> x = context.to_reduced(init);
+    result.params_vec = init;
+    if (n == 0 || iterations < 1){
+        result.success = true;
+        result.status = "nothing to minimize";
+        return result;
+    }
+
+    const double alpha = 0.602, gamma = 0.101, A = 0.1 * iterations;
+    std::mt19937 generator(1);
+    std::vector<double> no_grad;
+    double f_last = NAN;
+
+    auto gradient = [&](double c_k, std::vector<double> &g){
+        /* gradient estimate in units of the steps, false if an evaluation failed (NaN) */
+        std::vector<double> x_plus = x, x_minus = x;
+        for (size_t i=0; i<n; ++i){
+            double delta = generator() & 1 ? 1 : -1;
+            // delta can be negative, thus both points are clamped to both bounds
+            x_plus[i] = std::max(lower[i], std::min(x[i] + c_k * delta * steps[i], upper[i]));
+            x_minus[i] = std::max(lower[i], std::min(x[i] - c_k * delta * steps[i], upper[i]));
+        }
+        double f_plus = reduced_target(x_plus, no_grad, &context);
+        double f_minus = reduced_target(x_minus, no_grad, &context);
+        f_last = (f_plus + f_minus) / 2;
+        g.assign(n, 0);
+        if (!is_finite(f_plus) || !is_finite(f_minus))
+            return false;
+        for (size_t i=0; i<n; ++i)
+            if (x_plus[i] != x_minus[i])
+                g[i] = (f_plus - f_minus) / (x_plus[i] - x_minus[i]) * steps[i];
+        return true;
+    };
+
+    try{
+        // calibration of a with the batch of the first iteration
+        next_batch(0);
+        std::vector<double> g;
+        double g_mean = 0;
+        int n_estimates = 0;
+        for (int j=0; j<4; ++j){
+            if (gradient(1, g)){
+                for (size_t i=0; i<n; ++i)
+                    g_mean += std::abs(g[i]) / n;
+                ++n_estimates;
+            }
+        }
+        if (!n_estimates || g_mean == 0){
+            result.status = "failed: no gradient at the starting point";
+            result.evaluations = context.evaluations;
+            return result;
+        }
+        g_mean /= n_estimates;
+        double a = 10 * std::pow(A + 1, alpha) / g_mean;
+
+        for (int k=0; k<iterations; ++k){
+            next_batch(k);
+            double a_k = a / std::pow(k + 1 + A, alpha);
+            double c_k = 1 / std::pow(k + 1, gamma);
+            if (!gradient(c_k, g))
+                continue;
+            for (size_t i=0; i<n; ++i){
+                // at most 20 initial steps per iteration, large noisy gradients must not throw x far off
+                double dz = std::max(-20., std::min(a_k * g[i], 20.));
+                x[i] = std::max(lower[i], std::min(x[i] - dz * steps[i], upper[i]));
+            }
+        }
+        result.success = true;
+        result.status = "iterations done";
+    }
+    catch(nlopt::forced_stop &e) {
+        result.status = "stopped by signal";
+    }
+    result.params_vec = context.to_full(x);
+    result.minf = f_last;
+    result.init_f = context.first_f;
+    result.evaluations = context.evaluations;
+    return result;
+}
+
+#endif
@@ -2,19 +2,40 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <sstream>
 
 #include <vector>
 #include <map> 
+#include <unordered_map>
+#include <set>
+#include <future>
+#include <memory>
 #include <cmath>
+#include <cstdint>
 #include <numeric> // for accumulate and inner_product
+#include <algorithm>
 
 #include <Eigen/Core>
 #include <Eigen/LU> 
 
+#include "input_stream.h"
+
 // ============================================================================= //
 // MOMAdata CLASS
 // ============================================================================= //
 
+/*
+* Storage type of the observed time series. Compiling with -DCOMPACT_STORAGE stores them
+* as float32 (half the memory), the values are widened to double when used in the filter.
+* To keep the precision of the time increments, the time of a cell is then stored relative 
+* to its first time point (time_offset).
+*/
+#ifdef COMPACT_STORAGE
+typedef Eigen::VectorXf obs_vector;
+#else
+typedef Eigen::VectorXd obs_vector;
+#endif
+
 class MOMAdata{
     /*  
     * A class containing data from a MOMA-csv file (or similar) for a single cell 
@@ -25,6 +46,9 @@ public:
     std::string cell_id;
     std::string parent_id;
 
+    // index of the input file the cell was read from
+    int file_idx = 0;
+
     // Pointer to other instances of the class representing the genealogy
     MOMAdata *parent = nullptr;
     MOMAdata *daughter1 = nullptr;
@@ -32,9 +56,11 @@ public:
 
     // Time dependent quantities (and time) of the cell
     // stores in eigen vectors to enable lin algebra functions
-    Eigen::VectorXd time;
-    Eigen::VectorXd log_length;
-    Eigen::VectorXd fp;
+    // with COMPACT_STORAGE those are floats and the time is relative to time_offset
+    obs_vector time;
+    obs_vector log_length;
+    obs_vector fp;
+    double time_offset = 0;
 
     int generation;
 
@@ -46,15 +72,22 @@ public:
     Eigen::VectorXd mean = Eigen::VectorXd::Zero(4);
     Eigen::MatrixXd cov = Eigen::MatrixXd::Zero(4, 4);
 
-    // predictions
-    std::vector<Eigen::Vector4d> mean_forward;
-    std::vector<Eigen::Matrix4d> cov_forward;
+    // initial guess and current state of the backward prediction, 
+    // kept apart from the forward ones such that both directions can run concurrently
+    Eigen::VectorXd mean_init_r = Eigen::VectorXd::Zero(4);
+    Eigen::MatrixXd cov_init_r = Eigen::MatrixXd::Zero(4, 4);
 
-    std::vector<Eigen::Vector4d> mean_backward;
-    std::vector<Eigen::Matrix4d> cov_backward;
+    Eigen::VectorXd mean_r = Eigen::VectorXd::Zero(4);
+    Eigen::MatrixXd cov_r = Eigen::MatrixXd::Zero(4, 4);
 
-    std::vector<Eigen::Vector4d> mean_prediction;
-    std::vector<Eigen::Matrix4d> cov_prediction;
+    // index of the first time point of the cell in the Prediction_arena
+    size_t offset = 0;
+
+    // directions of the prediction that are run for this cell and whether it is written, 
+    // restricted by select_cells to the cells that are needed for a selection, by default all are
+    bool needs_forward = true;
+    bool needs_backward = true;
+    bool selected = true;
 
     // member functions
     bool is_leaf() const;
@@ -108,21 +141,27 @@ bool MOMAdata :: is_root() const {
 
 void build_cell_genealogy(std::vector<MOMAdata> &cell_vector){
     /*  
-    * Assign respective pointers to parent, daughter1 and daughter2 for each cell
+    * Assign respective pointers to parent, daughter1 and daughter2 for each cell,
+    * the parent is looked up via a map from cell_id to the index in cell_vector
     */
+    std::unordered_map<std::string, size_t> cell_indices;
+    for(size_t j = 0; j < cell_vector.size(); ++j) {
+        cell_indices.insert(std::pair<std::string, size_t>(cell_vector[j].cell_id, j));
+    }
+
     for(size_t k = 0; k < cell_vector.size(); ++k) {
-        for(size_t j = 0; j < cell_vector.size(); ++j) {
-            if( cell_vector[j].cell_id == cell_vector[k].parent_id ){
-                //  Assign pointers to PARENT variable of the cell
-                cell_vector[k].parent = &cell_vector[j];
-                //  Assign pointers to CELL of the parent cell to 'free' pointer
-                if (cell_vector[j].daughter1 == nullptr)
-                    cell_vector[j].daughter1 = &cell_vector[k];
-                else if (cell_vector[j].daughter2 == nullptr)
-                    cell_vector[j].daughter2 = &cell_vector[k];
-                else
-                    std::cout << "(build_cell_genealogy) Warning: both daughter pointers are set!" << std::endl;
-            }
+        auto it = cell_indices.find(cell_vector[k].parent_id);
+        if (it != cell_indices.end()){
+            size_t j = it->second;
+            //  Assign pointers to PARENT variable of the cell
+            cell_vector[k].parent = &cell_vector[j];
+            //  Assign pointers to CELL of the parent cell to 'free' pointer
+            if (cell_vector[j].daughter1 == nullptr)
+                cell_vector[j].daughter1 = &cell_vector[k];
+            else if (cell_vector[j].daughter2 == nullptr)
+                cell_vector[j].daughter2 = &cell_vector[k];
+            else
+                std::cout << "(build_cell_genealogy) Warning: both daughter pointers are set!" << std::endl;
         }
     }
 }
@@ -344,7 +383,7 @@ std::map<std::string, int> get_header_indices(std::vector<std::string> &str_vec)
 }
 
 
-void append_vec(Eigen::VectorXd &v, double elem){
+void append_vec(obs_vector &v, double elem){
     /*  
     * push_back alternative for non std vector (with resize() and size()), 
     * probaly slow and should only be used to read the csv 
@@ -355,6 +394,141 @@ void append_vec(Eigen::VectorXd &v, double elem){
 }
 
 
+void split_line(const std::string &line, const std::string &delm, 
+                size_t n_cols, std::vector<std::string> &parts){
+    /*  
+    * Splits line at delm into parts, but only up to the first n_cols columns, 
+    * the rest of the line is never tokenized (columns that are not used are skipped)
+    */
+    parts.clear();
+    size_t start = 0;
+    size_t pos;
+    while (parts.size() < n_cols){
+        pos = line.find(delm, start);
+        if (pos == std::string::npos){
+            parts.push_back(line.substr(start));
+            break;
+        }
+        parts.push_back(line.substr(start, pos-start));
+        start = pos + delm.size();
+    }
+}
+
+
+class Row_filter{
+    /*  
+    * Predicate on a single column of the input file, parsed from an expression like
+    *   lane_ID in (3,7)
+    *   pos == 2
+    *   length_um >= 1.5 
+    * Supported operators: in, ==, !=, <, <=, >, >=
+    * 'in', '==' and '!=' compare the (raw) strings, with endings like .0 removed
+    * such that '3' and '3.0' are the same, the others compare numerically: the right hand side 
+    * has to be a number (otherwise the filter is invalid) and rows with a token that is not
+    * a number (e.g. an empty cell) are rejected and counted in not_numeric. Rows that are too 
+    * short to have the column are rejected and counted in missing
+    */
+public:
+    std::string expression;
+    std::string column;
+    std::string op;
+    std::vector<std::string> values;
+    double number;
+    int col_idx = -1;
+    bool bad_number = false;
+    mutable long not_numeric = 0;
+    mutable long missing = 0;
+
+    Row_filter(std::string expr){
+        expression = expr;
+        std::vector<std::string> ops {" in ", "==", "!=", "<=", ">=", "<", ">"};
+        size_t pos = std::string::npos;
+        for (size_t i=0; i<ops.size() && pos == std::string::npos; ++i){
+            pos = expr.find(ops[i]);
+            if (pos != std::string::npos)
+                op = trim(ops[i]);
+        }
+        if (pos == std::string::npos){
+            std::cerr << "(Row_filter) Warning: no operator found in filter '" << expr << "', filter is ignored\n";
+            return;
+        }
+        column = trim(expr.substr(0, pos));
+        std::string rhs = trim(expr.substr(pos + (op == "in" ? 4 : op.size())));
+
+        if (op == "in"){
+            // strip the brackets
+            if (rhs.size() && rhs.front() == '(')
+                rhs = rhs.substr(1);
+            if (rhs.size() && rhs.back() == ')')
+                rhs.pop_back();
+            std::vector<std::string> val_split = split_string_at(rhs, ",");
+            for (size_t i=0; i<val_split.size(); ++i){
+                values.push_back(remove_last_decimal(trim(val_split[i])));
+            }
+        } else if (op == "==" || op == "!="){
+            values.push_back(remove_last_decimal(rhs));
+        } else if (!parse_number(rhs, number)){
+            std::cerr << "(Row_filter) Error: '" << rhs << "' in filter '" << expr << "' is not a number\n";
+            bad_number = true;
+        }
+    }
+
+    bool valid() const{
+        return !op.empty();
+    }
+
+    bool set_column(std::map<std::string, int> &header_indices){
+        /* resolves the column name to its index in the header, returns false if not found */
+        if (!header_indices.count(column))
+            return false;
+        col_idx = header_indices[column];
+        return true;
+    }
+
+    bool accept(const std::vector<std::string> &line_parts) const{
+        /* evaluates the predicate on the (not yet converted) tokens of a line */
+        if (col_idx < 0 || col_idx >= (int) line_parts.size()){
+            ++missing;
+            return false;
+        }
+        const std::string &token = line_parts[col_idx];
+        if (op == "in" || op == "==" || op == "!="){
+            std::string value = remove_last_decimal(token);
+            bool found = std::find(values.begin(), values.end(), value) != values.end();
+            return op == "!=" ? !found : found;
+        } 
+        double x;
+        if (!parse_number(token, x)){
+            ++not_numeric;
+            return false;
+        }
+        if (op == "<")
+            return x < number;
+        if (op == "<=")
+            return x <= number;
+        if (op == ">")
+            return x > number;
+        return x >= number;
+    }
+};
+
+
+void prune_short_cells(std::vector<MOMAdata> &data, int min_points, std::ostream &info = std::cout){
+    /*  
+    * Removes all cells with less than min_points data points. The daughters of a removed cell 
+    * will not find their parent in build_cell_genealogy and thus become roots of their own trees
+    */
+    if (min_points <= 0)
+        return;
+    size_t n_before = data.size();
+    data.erase(std::remove_if(data.begin(), data.end(), 
+                              [min_points](const MOMAdata &cell){ return cell.time.size() < min_points; }),
+               data.end());
+    if (data.size() < n_before)
+        info << n_before - data.size() << " cells with less than " << min_points << " data points removed" << std::endl; 
+}
+
+
 std::vector<MOMAdata> getData(std::string filename,
                             std::string time_col, 
                             double divide_time,
@@ -363,15 +537,35 @@ std::vector<MOMAdata> getData(std::string filename,
                             std::string fp_col, 
                             std::string delm,
                             std::vector<std::string> cell_tags,
-                            std::vector<std::string> parent_tags){
+                            std::vector<std::string> parent_tags,
+                            std::vector<std::string> filter_expressions = {},
+                            double time_min = -HUGE_VAL,
+                            double time_max = HUGE_VAL,
+                            int min_points = 0,
+                            bool *read_error = nullptr,
+                            std::ostream &info = std::cout){
     /*  
-    * Parses through csv file line by line and returns the data as a vector of MOMAdata instances
+    * Parses through csv file line by line and returns the data as a vector of MOMAdata instances.
+    * Rows are selected while reading: the filters (and end_type) are evaluated on the raw tokens,
+    * the time window on the converted time (i.e. after division by divide_time), only then the 
+    * remaining columns are converted. Cells with less than min_points points are dropped.
+    * Compressed files (gzip, zstd) are decompressed on the fly, see Input_stream. If the file 
+    * can not be read completely (e.g. a truncated compressed file), no data is returned and 
+    * read_error (if given) is set. The progress messages go to info
     */
-    std::ifstream file(filename);
+    Input_stream file(filename);
+    std::vector<MOMAdata> data;
+    if (!file){
+        std::cerr << "Could not open input file " << filename << "\n";
+        if (read_error)
+            *read_error = true;
+        return data;
+    }
+    if (file.compression() != "none")
+        info << "Reading " << file.compression() << " compressed file " << filename << std::endl;
     
     std::vector<std::string> line_parts;
     std::string line;
-    std::vector<MOMAdata> data;
 
     // read the header and assign an index to every entry, such that we can 'index' with a string
     getline(file, line);
@@ -390,6 +584,33 @@ std::vector<MOMAdata> getData(std::string filename,
         std::cerr << fp_col << " (fp_col) is not an column in input file!\n";
         return data;
     }
+
+    std::vector<Row_filter> filters;
+    for (size_t i=0; i<filter_expressions.size(); ++i){
+        Row_filter filter(filter_expressions[i]);
+        if (filter.bad_number)
+            return data;
+        if (!filter.valid())
+            continue;
+        if (!filter.set_column(header_indices)){
+            std::cerr << filter.column << " (filter) is not an column in input file!\n";
+            return data;
+        }
+        filters.push_back(filter);
+    }
+
+    // only the columns up to the last one that is used are tokenized
+    int n_cols = std::max({header_indices[time_col], header_indices[length_col], header_indices[fp_col]});
+    for (size_t i=0; i<cell_tags.size(); ++i)
+        n_cols = std::max(n_cols, header_indices[cell_tags[i]]);
+    for (size_t i=0; i<parent_tags.size(); ++i)
+        n_cols = std::max(n_cols, header_indices[parent_tags[i]]);
+    for (size_t i=0; i<filters.size(); ++i)
+        n_cols = std::max(n_cols, filters[i].col_idx);
+    bool has_end_type = header_indices.count("end_type");
+    if (has_end_type)
+        n_cols = std::max(n_cols, header_indices["end_type"]);
+    ++n_cols;
     
     // Iterate through each line and split the content using the delimeter then assign the 
     std::string last_cell = "";
@@ -397,39 +618,226 @@ std::vector<MOMAdata> getData(std::string filename,
 
     int last_idx = -1;
     long line_count = 0;
+    long point_count = 0;
+    double time;
+    bool accept;
     while (getline(file, line)) {
+        // a line without newline at the end of a broken stream is incomplete
+        if (file.eof() && !file.error().empty())
+            break;
         ++line_count;
-        line_parts = split_string_at(line, delm);
+        split_line(line, delm, n_cols, line_parts);
         // take lines only if end_type==div or header_indices "end_type" is not in header_indices
-        if (header_indices.count("end_type") == 0 || line_parts[header_indices["end_type"]] == "div" ){
-            curr_cell = get_cell_id(line_parts, header_indices, cell_tags);
+        if (has_end_type && line_parts[header_indices["end_type"]] != "div")
+            continue;
 
-            if (last_cell != curr_cell){
-                last_idx++;
-                MOMAdata next_cell;
-                // add new MOMAdata instance to vector 
-                data.push_back(next_cell); 
+        accept = true;
+        for (size_t i=0; i<filters.size() && accept; ++i){
+            accept = filters[i].accept(line_parts);
+        }
+        if (!accept)
+            continue;
+
+        time = std::stod(line_parts[header_indices[time_col]])/divide_time;
+        if (time < time_min || time > time_max)
+            continue;
+
+        curr_cell = get_cell_id(line_parts, header_indices, cell_tags);
+
+        if (last_cell != curr_cell){
+            last_idx++;
+            MOMAdata next_cell;
+            // add new MOMAdata instance to vector 
+            data.push_back(next_cell); 
+
+            data[last_idx].cell_id = curr_cell;
+            data[last_idx].parent_id = get_cell_id(line_parts, header_indices, parent_tags);
+#ifdef COMPACT_STORAGE
+            data[last_idx].time_offset = time;
+#endif
+        }
 
-                data[last_idx].cell_id = curr_cell;
-                data[last_idx].parent_id = get_cell_id(line_parts, header_indices, parent_tags);
-            }
+        append_vec(data[last_idx].time, time - data[last_idx].time_offset);
 
-            append_vec(data[last_idx].time,  std::stod(line_parts[header_indices[time_col]])/divide_time );
+        if (length_islog)
+            append_vec(data[last_idx].log_length,  std::stod(line_parts[header_indices[length_col]]) );
+        else
+            append_vec(data[last_idx].log_length,  log(std::stod(line_parts[header_indices[length_col]])) );
 
-            if (length_islog)
-                append_vec(data[last_idx].log_length,  std::stod(line_parts[header_indices[length_col]]) );
-            else
-                append_vec(data[last_idx].log_length,  log(std::stod(line_parts[header_indices[length_col]])) );
+        append_vec(data[last_idx].fp,  std::stod(line_parts[header_indices[fp_col]]) );
+        last_cell = curr_cell;
+        ++point_count;
+    }
+    if (!file.error().empty()){
+        std::cerr << "Error reading input file " << filename << " after " << line_count << " rows: " 
+                  << file.error() << "\n";
+        if (read_error)
+            *read_error = true;
+        return std::vector<MOMAdata>();
+    }
+    std::stringstream message;
+    message << last_idx + 1 << " cells and " << point_count << " data points found in file " << filename;
+    if (point_count < line_count)
+        message << " (" << line_count - point_count << " rows rejected)";
+    for (size_t i=0; i<filters.size(); ++i){
+        if (filters[i].not_numeric)
+            message << "\nWarning: " << filters[i].not_numeric << " rows with a non-numeric " << filters[i].column 
+                    << " rejected by the filter '" << filters[i].expression << "'";
+        if (filters[i].missing)
+            message << "\nWarning: " << filters[i].missing << " rows without a " << filters[i].column 
+                    << " column rejected by the filter '" << filters[i].expression << "'";
+    }
+    info << message.str() << std::endl; 
+
+    prune_short_cells(data, min_points, info);
+    return data;
+}
+
+std::vector<MOMAdata> getData(std::vector<std::string> filenames,
+                            std::string time_col, 
+                            double divide_time,
+                            std::string length_col,
+                            bool length_islog, 
+                            std::string fp_col, 
+                            std::string delm,
+                            std::vector<std::string> cell_tags,
+                            std::vector<std::string> parent_tags,
+                            std::vector<std::string> filter_expressions = {},
+                            double time_min = -HUGE_VAL,
+                            double time_max = HUGE_VAL,
+                            int min_points = 0){
+    /*  
+    * Reads several files (each on its own thread) and returns all cells as one data set.
+    * To avoid collisions of the ids, the cell and parent ids are prefixed with the 
+    * base of the file name (or the index of the file, if those are not unique), e.g. 'pos0:20150624.0.1.5'
+    */
+    if (filenames.size() == 1)
+        return getData(filenames[0], time_col, divide_time, length_col, length_islog, fp_col, delm, 
+                        cell_tags, parent_tags, filter_expressions, time_min, time_max, min_points);
+
+    // the messages of each file are collected and printed in file order, the files are read in parallel
+    std::vector<std::future<std::vector<MOMAdata>>> futures;
+    std::unique_ptr<bool[]> read_errors(new bool[filenames.size()]());
+    std::unique_ptr<std::stringstream[]> infos(new std::stringstream[filenames.size()]);
+    for (size_t i=0; i<filenames.size(); ++i){
+        bool *read_error = &read_errors[i];
+        std::stringstream *info = &infos[i];
+        futures.push_back(std::async(std::launch::async, [=](){
+            return getData(filenames[i], time_col, divide_time, length_col, length_islog, fp_col, delm, 
+                            cell_tags, parent_tags, filter_expressions, time_min, time_max, min_points, read_error, *info);
+        }));
+    }
 
-            append_vec(data[last_idx].fp,  std::stod(line_parts[header_indices[fp_col]]) );
-            last_cell = curr_cell;
+    std::set<std::string> bases;
+    for (size_t i=0; i<filenames.size(); ++i){
+        bases.insert(file_base(filenames[i]));
+    }
+    bool unique_bases = bases.size() == filenames.size();
+
+    std::vector<MOMAdata> data;
+    for (size_t i=0; i<futures.size(); ++i){
+        std::vector<MOMAdata> file_data = futures[i].get();
+        std::cout << infos[i].str() << std::flush;
+        std::string prefix = (unique_bases ? file_base(filenames[i]) : std::to_string(i)) + ":";
+        for (size_t j=0; j<file_data.size(); ++j){
+            file_data[j].cell_id = prefix + file_data[j].cell_id;
+            file_data[j].parent_id = prefix + file_data[j].parent_id;
+            file_data[j].file_idx = i;
+            data.push_back(std::move(file_data[j]));
         }
     }
-    file.close();
-    std::cout << last_idx + 1 << " cells and " << line_count << " data points found in file " << filename << std::endl; 
+    // no fit on a partial data set
+    for (size_t i=0; i<filenames.size(); ++i){
+        if (read_errors[i]){
+            std::cerr << "Input file " << filenames[i] << " could not be read completely, no data is used\n";
+            return std::vector<MOMAdata>();
+        }
+    }
+    std::cout << data.size() << " cells found in " << filenames.size() << " files" << std::endl;
     return data;
 }
 
+size_t data_memory(const std::vector<MOMAdata> &cells, size_t scalar_size = sizeof(obs_vector::Scalar)){
+    /*  
+    * Estimate of the memory (in bytes) used by the cells: the class itself, the ids,
+    * the mean/cov state (allocated on the heap) and the three observed time series, 
+    * assuming scalar_size bytes per value of the time series
+    */
+    size_t bytes = cells.capacity() * sizeof(MOMAdata);
+    for (size_t i=0; i<cells.size(); ++i){
+        bytes += cells[i].cell_id.capacity() + cells[i].parent_id.capacity();
+        bytes += 4 * (4 + 16) * sizeof(double);
+        bytes += 3 * cells[i].time.size() * scalar_size;
+    }
+    return bytes;
+}
+
+void print_data_memory(const std::vector<MOMAdata> &cells){
+    /* prints the memory used by the data, and what it would be with the other storage type */
+    double mb = 1024. * 1024.;
+    std::cout << "Memory used by the data: " << data_memory(cells) / mb << " MB";
+#ifdef COMPACT_STORAGE
+    std::cout << " (float32 storage, " << data_memory(cells, sizeof(double)) / mb << " MB with double storage)";
+#else
+    std::cout << " (double storage, " << data_memory(cells, sizeof(float)) / mb << " MB with compact float32 storage)";
+#endif
+    std::cout << std::endl;
+}
+
+std::vector<MOMAdata> thin_cells(const std::vector<MOMAdata> &cells, size_t k){
+    /* 
+    * copy of the cells with every k-th time point and the last one (before the division) of each cell, 
+    * the genealogy is built for the copy. The model uses the time differences, thus the larger steps 
+    * between the remaining points are accounted for
+    */
+    std::vector<MOMAdata> thinned = cells;
+    for (size_t i=0; i<thinned.size(); ++i){
+        MOMAdata &cell = thinned[i];
+        cell.parent = cell.daughter1 = cell.daughter2 = nullptr;
+        size_t n = cells[i].time.size();
+        std::vector<size_t> idx;
+        for (size_t t=0; t<n; t+=k)
+            idx.push_back(t);
+        if (n && idx.back() != n-1)
+            idx.push_back(n-1);
+        cell.time.resize(idx.size());
+        cell.log_length.resize(idx.size());
+        cell.fp.resize(idx.size());
+        for (size_t j=0; j<idx.size(); ++j){
+            cell.time(j) = cells[i].time(idx[j]);
+            cell.log_length(j) = cells[i].log_length(idx[j]);
+            cell.fp(j) = cells[i].fp(idx[j]);
+        }
+    }
+    build_cell_genealogy(thinned);
+    return thinned;
+}
+
+
+uint64_t data_fingerprint(const std::vector<MOMAdata> &cells){
+    /* 
+    * FNV-1a hash of the data as it is stored (ids, genealogy, time series), identifies the data set 
+    * e.g. for the persistent likelihood cache. A single file can be renamed, with several files
+    * the ids carry the base of the file names (see getData), thus renaming those changes the hash
+    */
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const void *p, size_t n){
+        for (size_t i=0; i<n; ++i){
+            hash ^= ((const unsigned char *) p)[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+    for (size_t i=0; i<cells.size(); ++i){
+        add(cells[i].cell_id.c_str(), cells[i].cell_id.size() + 1);
+        add(cells[i].parent_id.c_str(), cells[i].parent_id.size() + 1);
+        add(&cells[i].time_offset, sizeof(double));
+        add(cells[i].time.data(), cells[i].time.size() * sizeof(cells[i].time(0)));
+        add(cells[i].log_length.data(), cells[i].log_length.size() * sizeof(cells[i].log_length(0)));
+        add(cells[i].fp.data(), cells[i].fp.size() * sizeof(cells[i].fp(0)));
+    }
+    return hash;
+}
+
 // ============================================================================= //
 // MEAN/COV
 // ============================================================================= //
@@ -508,8 +916,8 @@ void init_cells(std::vector<MOMAdata> &cells, int n_cells = 3){
         if(cells[i].time.size()>=n_cells){
             x0.push_back(cells[i].log_length(0));
             g0.push_back(cells[i].fp(0));
-            l0.push_back(lin_fit_slope(cells[i].time.head(n_cells), cells[i].log_length.head(n_cells)));
-            q0.push_back(lin_fit_slope(cells[i].time.head(n_cells), cells[i].fp.head(n_cells)));
+            l0.push_back(lin_fit_slope(cells[i].time.head(n_cells).cast<double>(), cells[i].log_length.head(n_cells).cast<double>()));
+            q0.push_back(lin_fit_slope(cells[i].time.head(n_cells).cast<double>(), cells[i].fp.head(n_cells).cast<double>()));
         }
     }
 
@@ -531,8 +939,8 @@ void init_cells_r(std::vector<MOMAdata> &cells, int n_cells = 3){
     * the data using the LAST time point and the LAST n time points of each cell 
     */
     for(size_t i=0; i<cells.size(); ++i){
-        cells[i].mean_init = Eigen::VectorXd::Zero(4);
-        cells[i].cov_init = Eigen::MatrixXd::Zero(4, 4);
+        cells[i].mean_init_r = Eigen::VectorXd::Zero(4);
+        cells[i].cov_init_r = Eigen::MatrixXd::Zero(4, 4);
     }
 
     std::vector<double> x0;
@@ -544,18 +952,18 @@ void init_cells_r(std::vector<MOMAdata> &cells, int n_cells = 3){
         if(cells[i].time.size()>=n_cells){
             x0.push_back(cells[i].log_length(cells[i].log_length.size()-1));
             g0.push_back(cells[i].fp(cells[i].log_length.size()-1));
-            l0.push_back(lin_fit_slope(cells[i].time.tail(n_cells), cells[i].log_length.tail(n_cells)));
-            q0.push_back(lin_fit_slope(cells[i].time.tail(n_cells), cells[i].fp.tail(n_cells)));
+            l0.push_back(lin_fit_slope(cells[i].time.tail(n_cells).cast<double>(), cells[i].log_length.tail(n_cells).cast<double>()));
+            q0.push_back(lin_fit_slope(cells[i].time.tail(n_cells).cast<double>(), cells[i].fp.tail(n_cells).cast<double>()));
         }
     }
 
     std::vector<MOMAdata *> leafs = get_leafs(cells);
     for(size_t i=0; i<leafs.size(); ++i){
-        leafs[i]->mean_init << vec_mean(x0),vec_mean(g0),vec_mean(l0),vec_mean(q0);
-        leafs[i]->cov_init(0,0) = vec_var(x0);
-        leafs[i]->cov_init(1,1) = vec_var(g0);
-        leafs[i]->cov_init(2,2) = vec_var(l0);
-        leafs[i]->cov_init(3,3) = vec_var(q0);
+        leafs[i]->mean_init_r << vec_mean(x0),vec_mean(g0),vec_mean(l0),vec_mean(q0);
+        leafs[i]->cov_init_r(0,0) = vec_var(x0);
+        leafs[i]->cov_init_r(1,1) = vec_var(g0);
+        leafs[i]->cov_init_r(2,2) = vec_var(l0);
+        leafs[i]->cov_init_r(3,3) = vec_var(q0);
     }
 }
 
@@ -0,0 +1,189 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include <zlib.h>
+
+#ifndef NPZ_WRITER_H
+#define NPZ_WRITER_H
+
+// ============================================================================= //
+// NPZ WRITER
+// ============================================================================= //
+
+void append_le(std::string &buffer, uint64_t value, int n_bytes){
+    /* appends the n_bytes lowest bytes of value in little-endian order */
+    for (int i=0; i<n_bytes; ++i){
+        buffer.push_back((char) ((value >> (8*i)) & 0xff));
+    }
+}
+
+void append_le(std::string &buffer, double value){
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    append_le(buffer, bits, 8);
+}
+
+
+class Npz_writer{
+    /*
+    * Writes an uncompressed .npz (zip archive of .npy files) that is filled in a streaming fashion.
+    * All arrays are declared with their shape first (add_array), which fixes the layout of the
+    * archive, then the data of each array is appended in order (append), interleaved between the
+    * arrays as needed. close() fills in the checksums and writes the zip directory.
+    * The data is passed in little-endian byte order, see append_le
+    */
+public:
+    bool open(std::string filename){
+        name = filename;
+        file.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open()){
+            std::cerr << "(Npz_writer) Error: could not open " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    size_t add_array(std::string array_name, std::string descr, std::vector<size_t> shape, size_t item_size){
+        /* declares an array, descr is the numpy type, e.g. '<f8', '<i8' or '|S10', returns its index */
+        Member member;
+        member.name = array_name + ".npy";
+
+        std::string shape_str = "(";
+        size_t n = 1;
+        for (size_t i=0; i<shape.size(); ++i){
+            shape_str += std::to_string(shape[i]) + (shape.size() == 1 ? "," : (i+1 < shape.size() ? ", " : ""));
+            n *= shape[i];
+        }
+        shape_str += ")";
+
+        // .npy format 1.0: magic, version, header length and header dict padded to a multiple of 64 bytes
+        std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': " + shape_str + ", }";
+        size_t total = 10 + dict.size() + 1;
+        dict += std::string((64 - total % 64) % 64, ' ') + "\n";
+        member.npy_header = std::string("\x93NUMPY\x01\x00", 8);
+        append_le(member.npy_header, dict.size(), 2);
+        member.npy_header += dict;
+
+        member.data_size = n * item_size;
+        member.size = member.npy_header.size() + member.data_size;
+        member.offset = end;
+        member.position = end + 30 + member.name.size() + member.npy_header.size();
+        member.crc = crc32(0L, (const Bytef *) member.npy_header.data(), member.npy_header.size());
+        end = member.position + member.data_size;
+
+        if (member.size > 0xffffffffULL || end > 0xffffffffULL){
+            std::cerr << "(Npz_writer) Error: " << name << " exceeds 4 GB, which is not supported" << std::endl;
+            failed = true;
+        }
+
+        file.seekp(member.offset);
+        file.write(local_header(member).data(), 30 + member.name.size());
+        file.write(member.npy_header.data(), member.npy_header.size());
+
+        members.push_back(member);
+        return members.size() - 1;
+    }
+
+    void append(size_t array_idx, const std::string &data){
+        /* appends data to the array with index array_idx */
+        Member &member = members[array_idx];
+        if (member.written + data.size() > member.data_size){
+            std::cerr << "(Npz_writer) Error: too much data for array " << member.name << std::endl;
+            failed = true;
+            return;
+        }
+        file.seekp(member.position + member.written);
+        file.write(data.data(), data.size());
+        member.crc = crc32(member.crc, (const Bytef *) data.data(), data.size());
+        member.written += data.size();
+    }
+
+    bool close(){
+        /* writes the final local headers (with checksums) and the zip directory */
+        for (size_t i=0; i<members.size(); ++i){
+            if (members[i].written != members[i].data_size){
+                std::cerr << "(Npz_writer) Error: array " << members[i].name << " of " << name << " is incomplete" << std::endl;
+                failed = true;
+            }
+            file.seekp(members[i].offset);
+            file.write(local_header(members[i]).data(), 30 + members[i].name.size());
+        }
+
+        std::string directory;
+        for (size_t i=0; i<members.size(); ++i){
+            const Member &member = members[i];
+            append_le(directory, 0x02014b50, 4);    // central directory signature
+            append_le(directory, 20, 2);            // version made by
+            append_le(directory, 20, 2);            // version needed
+            append_le(directory, 0, 2);             // flags
+            append_le(directory, 0, 2);             // stored (no compression)
+            append_le(directory, 0, 2);             // time
+            append_le(directory, 0x21, 2);          // date (1980-01-01)
+            append_le(directory, member.crc, 4);
+            append_le(directory, member.size, 4);
+            append_le(directory, member.size, 4);
+            append_le(directory, member.name.size(), 2);
+            append_le(directory, 0, 2);             // extra field length
+            append_le(directory, 0, 2);             // comment length
+            append_le(directory, 0, 2);             // disk number
+            append_le(directory, 0, 2);             // internal attributes
+            append_le(directory, 0, 4);             // external attributes
+            append_le(directory, member.offset, 4);
+            directory += member.name;
+        }
+        append_le(directory, 0x06054b50, 4);        // end of central directory signature
+        append_le(directory, 0, 2);
+        append_le(directory, 0, 2);
+        append_le(directory, members.size(), 2);
+        append_le(directory, members.size(), 2);
+        append_le(directory, directory.size() - 12, 4);
+        append_le(directory, end, 4);
+        append_le(directory, 0, 2);
+
+        file.seekp(end);
+        file.write(directory.data(), directory.size());
+        file.close();
+        return !failed && !file.fail();
+    }
+
+private:
+    struct Member{
+        std::string name;
+        std::string npy_header;
+        size_t data_size = 0;   // bytes of the array data
+        size_t size = 0;        // bytes of the .npy file (header + data)
+        size_t offset = 0;      // position of the local zip header in the archive
+        size_t position = 0;    // position of the array data in the archive
+        size_t written = 0;
+        uLong crc = 0;
+    };
+
+    std::string name;
+    std::fstream file;
+    std::vector<Member> members;
+    size_t end = 0;
+    bool failed = false;
+
+    std::string local_header(const Member &member){
+        std::string header;
+        append_le(header, 0x04034b50, 4);   // local file header signature
+        append_le(header, 20, 2);           // version needed
+        append_le(header, 0, 2);            // flags
+        append_le(header, 0, 2);            // stored (no compression)
+        append_le(header, 0, 2);            // time
+        append_le(header, 0x21, 2);         // date (1980-01-01)
+        append_le(header, member.crc, 4);
+        append_le(header, member.size, 4);
+        append_le(header, member.size, 4);
+        append_le(header, member.name.size(), 2);
+        append_le(header, 0, 2);            // extra field length
+        header += member.name;
+        return header;
+    }
+};
+
+#endif
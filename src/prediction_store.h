@@ -0,0 +1,330 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <Eigen/Dense>
+
+#ifndef PREDICTION_STORE_H
+#define PREDICTION_STORE_H
+
+// ============================================================================= //
+// PREDICTION STORE
+// ============================================================================= //
+
+uint64_t read_le(const char *p, int n_bytes){
+    /* reads an unsigned integer of n_bytes stored in little-endian order */
+    uint64_t value = 0;
+    for (int i=n_bytes-1; i>=0; --i)
+        value = (value << 8) | (unsigned char) p[i];
+    return value;
+}
+
+
+struct Npy_array{
+    /* view of an array inside a mapped .npz file */
+    const char *data = nullptr;
+    std::string descr;
+    std::vector<size_t> shape;
+    size_t item_size = 0;
+};
+
+
+struct Cell_prediction{
+    std::string cell_id;
+    std::string parent_id;
+    std::vector<double> time;
+    std::vector<double> log_length;
+    std::vector<double> fp;
+    // all means and covariances or, for files with selected columns, the columns (named as in column_names)
+    std::vector<Eigen::Vector4d> mean;
+    std::vector<Eigen::Matrix4d> cov;
+    std::vector<std::vector<double>> columns;
+};
+
+
+class Prediction_store{
+    /*
+    * Read access to a prediction file written with '-f npz' (see Prediction_npz). The file is mapped
+    * into memory and only the pages of the requested cells are read: a cell is found by a binary search
+    * in cell_index, its rows via cell_offset and its lineage via lineage_offset.
+    * The numbers are read as stored (little-endian), as on the machines the predictions are made on
+    */
+public:
+    ~Prediction_store(){
+        if (map != MAP_FAILED)
+            munmap(map, map_size);
+    }
+
+    bool open(std::string filename){
+        name = filename;
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0){
+            std::cerr << "(Prediction_store) Error: could not open " << filename << std::endl;
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        map_size = st.st_size;
+        if (map_size > 0)
+            map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED){
+            std::cerr << "(Prediction_store) Error: could not map " << filename << std::endl;
+            return false;
+        }
+        if (!read_directory())
+            return false;
+
+        std::vector<std::string> required = {"cell_id", "parent_id", "cell_offset", "time", "log_length",
+                                             "fp", "cell_index", "lineage_offset"};
+        if (arrays.count("column_names")){
+            for (size_t i=0; i<arrays.at("column_names").shape[0]; ++i)
+                names.push_back(get_string("column_names", i));
+            required.insert(required.end(), names.begin(), names.end());
+        } else {
+            names = {"mean_x", "mean_g", "mean_l", "mean_q", "cov_xx", "cov_xg", "cov_xl", "cov_xq",
+                     "cov_gg", "cov_gl", "cov_gq", "cov_ll", "cov_lq", "cov_qq"};
+            required.push_back("mean");
+            required.push_back("cov");
+        }
+        for (size_t i=0; i<required.size(); ++i){
+            if (!arrays.count(required[i])){
+                std::cerr << "(Prediction_store) Error: " << filename << " has no array " << required[i]
+                          << " (not a prediction file?)" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const std::vector<std::string> &column_names() const{
+        /* names of the prediction columns in the file */
+        return names;
+    }
+
+    size_t size() const{
+        return arrays.at("cell_id").shape[0];
+    }
+
+    long find_cell(std::string id) const{
+        /* index of the cell with the given cell_id or -1 if there is none */
+        const Npy_array &ids = arrays.at("cell_id");
+        if (id.size() > ids.item_size)
+            return -1;
+        id.resize(ids.item_size, '\0');
+        const char *index = arrays.at("cell_index").data;
+
+        size_t lo = 0, hi = size();
+        while (lo < hi){
+            size_t mid = (lo + hi) / 2;
+            size_t k = read_le(index + 8*mid, 8);
+            int c = std::memcmp(ids.data + k*ids.item_size, id.data(), ids.item_size);
+            if (c == 0)
+                return k;
+            if (c < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return -1;
+    }
+
+    std::vector<size_t> lineage(size_t cell_idx) const{
+        /* indices of all cells of the lineage the cell belongs to */
+        const Npy_array &offsets = arrays.at("lineage_offset");
+        size_t lo = 0, hi = offsets.shape[0] - 1;
+        // last lineage that starts at or before cell_idx
+        while (hi - lo > 1){
+            size_t mid = (lo + hi) / 2;
+            if (read_le(offsets.data + 8*mid, 8) <= cell_idx)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        std::vector<size_t> cells;
+        for (size_t k=read_le(offsets.data + 8*lo, 8); k<read_le(offsets.data + 8*hi, 8); ++k)
+            cells.push_back(k);
+        return cells;
+    }
+
+    Cell_prediction cell(size_t cell_idx) const{
+        /* time series of data and prediction of a cell */
+        Cell_prediction cell;
+        cell.cell_id = get_string("cell_id", cell_idx);
+        cell.parent_id = get_string("parent_id", cell_idx);
+
+        const char *offsets = arrays.at("cell_offset").data;
+        size_t start = read_le(offsets + 8*cell_idx, 8);
+        size_t end = read_le(offsets + 8*(cell_idx+1), 8);
+        cell.columns.resize(arrays.count("column_names") ? names.size() : 0);
+        for (size_t k=start; k<end; ++k){
+            cell.time.push_back(get_double("time", k));
+            cell.log_length.push_back(get_double("log_length", k));
+            cell.fp.push_back(get_double("fp", k));
+            if (cell.columns.size()){
+                for (size_t l=0; l<names.size(); ++l)
+                    cell.columns[l].push_back(get_double(names[l], k));
+                continue;
+            }
+
+            Eigen::Vector4d m;
+            for (int l=0; l<4; ++l)
+                m(l) = get_double("mean", 4*k + l);
+            Eigen::Matrix4d c;
+            int n = 0;
+            for (int l=0; l<4; ++l){
+                for (int j=l; j<4; ++j){
+                    c(l, j) = get_double("cov", 10*k + n++);
+                    c(j, l) = c(l, j);
+                }
+            }
+            cell.mean.push_back(m);
+            cell.cov.push_back(c);
+        }
+        return cell;
+    }
+
+    void write_rows(std::ostream &out, size_t cell_idx) const{
+        /* writes the rows of a cell in the format of the csv prediction files */
+        Cell_prediction c = cell(cell_idx);
+        for (size_t k=0; k<c.time.size(); ++k){
+            out << c.cell_id << "," << c.time[k] << "," << c.log_length[k] << "," << c.fp[k];
+            for (size_t l=0; l<c.columns.size(); ++l)
+                out << "," << c.columns[l][k];
+            if (c.columns.size()){
+                out << "\n";
+                continue;
+            }
+            for (int l=0; l<4; ++l)
+                out << "," << c.mean[k](l);
+            for (int l=0; l<4; ++l)
+                for (int j=l; j<4; ++j)
+                    out << "," << c.cov[k](l, j);
+            out << "\n";
+        }
+    }
+
+private:
+    std::string name;
+    void *map = MAP_FAILED;
+    size_t map_size = 0;
+    std::map<std::string, Npy_array> arrays;
+    std::vector<std::string> names;
+
+    const char *bytes() const{
+        return (const char *) map;
+    }
+
+    std::string get_string(std::string array, size_t idx) const{
+        const Npy_array &a = arrays.at(array);
+        const char *p = a.data + idx*a.item_size;
+        return std::string(p, strnlen(p, a.item_size));
+    }
+
+    double get_double(std::string array, size_t idx) const{
+        double value;
+        uint64_t bits = read_le(arrays.at(array).data + 8*idx, 8);
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    bool error(std::string message){
+        std::cerr << "(Prediction_store) Error: " << name << ": " << message << std::endl;
+        return false;
+    }
+
+    bool read_directory(){
+        /* locates the arrays via the zip central directory, only uncompressed members are supported */
+        if (map_size < 22)
+            return error("not a zip file");
+        size_t eocd = map_size - 22;
+        while (read_le(bytes() + eocd, 4) != 0x06054b50){
+            if (eocd == 0 || map_size - eocd > 22 + 0xffff)
+                return error("not a zip file");
+            --eocd;
+        }
+        size_t n_entries = read_le(bytes() + eocd + 10, 2);
+        size_t pos = read_le(bytes() + eocd + 16, 4);
+
+        for (size_t i=0; i<n_entries; ++i){
+            if (pos + 46 > map_size || read_le(bytes() + pos, 4) != 0x02014b50)
+                return error("corrupt zip directory");
+            size_t method = read_le(bytes() + pos + 10, 2);
+            size_t size = read_le(bytes() + pos + 20, 4);
+            size_t name_len = read_le(bytes() + pos + 28, 2);
+            size_t extra_len = read_le(bytes() + pos + 30, 2);
+            size_t comment_len = read_le(bytes() + pos + 32, 2);
+            size_t local = read_le(bytes() + pos + 42, 4);
+            std::string member(bytes() + pos + 46, name_len);
+            pos += 46 + name_len + extra_len + comment_len;
+
+            if (method != 0)
+                return error(member + " is compressed, only uncompressed files (as written by -f npz) are supported");
+            if (local + 30 > map_size)
+                return error("corrupt zip directory");
+            size_t start = local + 30 + read_le(bytes() + local + 26, 2) + read_le(bytes() + local + 28, 2);
+            if (start + size > map_size)
+                return error("truncated file");
+            if (member.size() > 4 && member.substr(member.size()-4) == ".npy"){
+                Npy_array a;
+                if (!parse_npy(bytes() + start, size, a))
+                    return error("invalid array " + member);
+                arrays[member.substr(0, member.size()-4)] = a;
+            }
+        }
+        return true;
+    }
+
+    bool parse_npy(const char *p, size_t size, Npy_array &a){
+        /* reads the .npy header (format version 1 or 2) */
+        if (size < 10 || std::memcmp(p, "\x93NUMPY", 6) != 0)
+            return false;
+        int len_bytes = p[6] == 1 ? 2 : 4;
+        size_t header_len = read_le(p + 8, len_bytes);
+        size_t data_start = 8 + len_bytes + header_len;
+        if (data_start > size)
+            return false;
+        std::string header(p + 8 + len_bytes, header_len);
+        if (header.find("'fortran_order': False") == std::string::npos)
+            return false;
+
+        size_t d = header.find("'descr': '");
+        size_t s = header.find("'shape': (");
+        if (d == std::string::npos || s == std::string::npos)
+            return false;
+        d += 10;
+        a.descr = header.substr(d, header.find("'", d) - d);
+        if (a.descr.size() < 3 || (a.descr[0] != '<' && a.descr[0] != '|'))
+            return false;
+        a.item_size = std::stoul(a.descr.substr(2));
+
+        s += 10;
+        std::string shape = header.substr(s, header.find(")", s) - s);
+        size_t n = 1, i = 0;
+        while (i < shape.size()){
+            size_t j = shape.find(",", i);
+            if (j == std::string::npos)
+                j = shape.size();
+            if (shape.find_first_not_of(" ", i) < j){
+                a.shape.push_back(std::stoul(shape.substr(i, j - i)));
+                n *= a.shape.back();
+            }
+            i = j + 1;
+        }
+        if (data_start + n * a.item_size > size)
+            return false;
+        a.data = p + data_start;
+        return true;
+    }
+};
+
+#endif
@@ -1,20 +1,196 @@
 #include "moma_input.h"
 #include "mean_cov_model.h"
 #include "Parameters.h"
+#include "thread_pool.h"
+#include "npz_writer.h"
 
 #include <math.h>
 #include <cmath>
+#include <atomic>
+#include <Eigen/Cholesky>
+#include <thread>
+#include <memory>
+#include <functional>
 
 /* 
-* functions corresponding to backward part end with '_r'
+* functions corresponding to backward part end with '_r',
+* the backward part uses its own state (mean_r/cov_r) such that both directions can run concurrently
 */
 
+/* --------------------------------------------------------------------------
+* PREDICTION STORAGE
+* -------------------------------------------------------------------------- */
+
+class Prediction_arena{
+    /*
+    * Contiguous storage of the forward, backward and combined predictions of a set of cells 
+    * (a lineage or the whole data set). The prediction of time point t of a cell is stored at 
+    * index cell.offset + t, the memory is allocated once and written by index in both directions.
+    * Only the buffers needed for the requested outputs (f: forward, b: backward, c: combined) are allocated
+    */
+public:
+    // cells in the order of the input file
+    std::vector<MOMAdata*> cells;
+    bool forward = true;
+    bool backward = true;
+    bool combine = true;
+
+    std::vector<Eigen::Vector4d> mean_forward;
+    std::vector<Eigen::Matrix4d> cov_forward;
+
+    std::vector<Eigen::Vector4d> mean_backward;
+    std::vector<Eigen::Matrix4d> cov_backward;
+
+    std::vector<Eigen::Vector4d> mean_prediction;
+    std::vector<Eigen::Matrix4d> cov_prediction;
+
+    // only for the Rauch-Tung-Striebel smoother (instead of the backward prediction): 
+    // forward moments before the data point is taken into account and cross-covariance 
+    // between consecutive time points of a cell (stored at the index of the earlier one)
+    bool smoother = false;
+    std::vector<Eigen::Vector4d> mean_predicted;
+    std::vector<Eigen::Matrix4d> cov_predicted;
+    std::vector<Eigen::Matrix4d> cov_cross;
+
+    // number of directions (forward/backward) that are finished for each cell (indexed by cell.offset)
+    std::vector<std::atomic<int>> passes_done;
+    // number of daughters of each cell that are not yet done in backward direction (indexed by cell.offset)
+    std::vector<std::atomic<int>> daughters_pending;
+    // number of cells that are not complete, on_done is called once all cells are complete
+    std::atomic<size_t> cells_pending {0};
+    std::function<void()> on_done;
+
+    void allocate(const std::vector<MOMAdata*> &arena_cells, std::string outputs="fbc", bool rts=false){
+        /* 
+        * assigns the offset of each cell and allocates the memory for all time points, 
+        * cells that are not needed in any of the directions (see select_cells) are left out
+        */
+        combine = outputs.find('c') != std::string::npos;
+        forward = combine || outputs.find('f') != std::string::npos;
+        backward = !rts && (combine || outputs.find('b') != std::string::npos);
+        smoother = rts && combine;
+
+        cells.clear();
+        size_t n = 0;
+        for(size_t i=0; i<arena_cells.size(); ++i){
+            if ((forward && arena_cells[i]->needs_forward) || ((backward || smoother) && arena_cells[i]->needs_backward)){
+                cells.push_back(arena_cells[i]);
+                cells.back()->offset = n;
+                n += cells.back()->time.size();
+            }
+        }
+
+        if (forward){
+            mean_forward.resize(n);
+            cov_forward.resize(n);
+        }
+        if (backward){
+            mean_backward.resize(n);
+            cov_backward.resize(n);
+        }
+        if (smoother){
+            mean_predicted.resize(n);
+            cov_predicted.resize(n);
+            cov_cross.resize(n);
+        }
+        if (combine){
+            mean_prediction.resize(n);
+            cov_prediction.resize(n);
+        }
+
+        passes_done = std::vector<std::atomic<int>>(n);
+        daughters_pending = std::vector<std::atomic<int>>(n);
+        for(size_t i=0; i<cells.size(); ++i){
+            daughters_pending[cells[i]->offset] = (cells[i]->daughter1 != nullptr) + (cells[i]->daughter2 != nullptr);
+        }
+        cells_pending = cells.size();
+    }
+
+    void allocate(std::vector<MOMAdata> &all_cells, std::string outputs="fbc", bool rts=false){
+        std::vector<MOMAdata*> p_cells;
+        for(size_t i=0; i<all_cells.size(); ++i){
+            p_cells.push_back(&all_cells[i]);
+        }
+        allocate(p_cells, outputs, rts);
+    }
+
+    bool pass_done(const MOMAdata &cell){
+        /* marks one direction of the cell as done, returns true if it was the last one that is needed */
+        return passes_done[cell.offset].fetch_add(1) == forward*cell.needs_forward + backward*cell.needs_backward - 1;
+    }
+
+    bool daughter_done(const MOMAdata &cell){
+        /* marks one daughter of the cell as done (backward), returns true if it was the last one */
+        return daughters_pending[cell.offset].fetch_sub(1) == 1;
+    }
+
+    void cell_done(){
+        /* marks a cell as complete, the arena must not be used after the last cell (on_done may free it) */
+        if (cells_pending.fetch_sub(1) == 1 && on_done){
+            std::function<void()> done = on_done;
+            done();
+        }
+    }
+};
+
+/* --------------------------------------------------------------------------
+* COMBINATION OF FORWARD AND BACKWARD PREDICTION
+* -------------------------------------------------------------------------- */
+
+inline void gaussian_product(const Eigen::Vector4d &m1, const Eigen::Matrix4d &c1, 
+                            const Eigen::Vector4d &m2, const Eigen::Matrix4d &c2,
+                            Eigen::Vector4d &m, Eigen::Matrix4d &c){
+    /* 
+    * Product of two gaussians (up to normalization) with a single factorization:
+    * (c1^-1 + c2^-1)^-1 = c1 - c1 (c1+c2)^-1 c1, written via the gain K = c1 (c1+c2)^-1, 
+    * which avoids the five 4x4 inversions of the information form
+    */
+    Eigen::LDLT<Eigen::Matrix4d> ldlt(c1 + c2);
+    Eigen::Matrix4d Kt = ldlt.solve(c1); // = K^T since c1 and c2 are symmetric
+    m = m1 + Kt.transpose() * (m2 - m1);
+    c = c1 - Kt.transpose() * c1;
+    c = 0.5 * (c + c.transpose()).eval();
+}
+
+void gaussian_products(size_t n, const Eigen::Vector4d *m1, const Eigen::Matrix4d *c1, 
+                        const Eigen::Vector4d *m2, const Eigen::Matrix4d *c2,
+                        Eigen::Vector4d *m, Eigen::Matrix4d *c){
+    /* 
+    * gaussian_product of n consecutive pairs, one pair after the other, all fixed-size
+    * such that the loop does not allocate on the heap
+    */
+    for (size_t j=0; j<n; ++j){
+        gaussian_product(m1[j], c1[j], m2[j], c2[j], m[j], c[j]);
+    }
+}
+
+void multiply_gaussian(Eigen::VectorXd &m1, Eigen::MatrixXd &c1, const Eigen::Vector4d &m2, const Eigen::Matrix4d &c2){
+    /* Multiply first gaussian with second one - inplace multiplication */
+    Eigen::Vector4d m;
+    Eigen::Matrix4d c;
+    gaussian_product(m1, c1, m2, c2, m, c);
+    m1 = m;
+    c1 = c;
+}
+
+void combine_predictions(const MOMAdata &cell, Prediction_arena &arena){
+    /* 
+    * combines foward and backward predictions of a cell by multiplying the gaussians of those predictions,
+    * called by whichever direction finishes the cell last
+    */
+    size_t k = cell.offset;
+    gaussian_products(cell.time.size(), &arena.mean_forward[k], &arena.cov_forward[k], 
+                        &arena.mean_backward[k], &arena.cov_backward[k], 
+                        &arena.mean_prediction[k], &arena.cov_prediction[k]);
+}
+
 /* --------------------------------------------------------------------------
 * FORWARD PREDICTION
 * -------------------------------------------------------------------------- */
 
 /* -------------------------------------------------------------------------- */
-void mean_cov_after_division(MOMAdata &cell, double var_dx, double var_dg){
+void mean_cov_after_division(const Eigen::VectorXd &parent_mean, const Eigen::MatrixXd &parent_cov,
+                            Eigen::VectorXd &mean, Eigen::MatrixXd &cov, double var_dx, double var_dg){
     // tested (i.e. same output as python functions)
     /*
     * mean and covariance matrix are updated as cell division occurs, thus 
@@ -27,20 +203,31 @@ void mean_cov_after_division(MOMAdata &cell, double var_dx, double var_dg){
     D(0,0) = var_dx;
     D(1,1) = var_dg;
 
-    cell.mean = F*cell.parent->mean + f;
-    cell.cov = D + F * cell.parent->cov * F.transpose();
+    mean = F*parent_mean + f;
+    cov = D + F * parent_cov * F.transpose();
 }
 
-void posterior(Eigen::MatrixXd xgt, MOMAdata &cell, Eigen::Matrix2d S, Eigen::Matrix2d Si){
+void mean_cov_after_division(MOMAdata &cell, double var_dx, double var_dg){
+    /* updates the (forward) state of the cell from the state of its parent */
+    mean_cov_after_division(cell.parent->mean, cell.parent->cov, cell.mean, cell.cov, var_dx, var_dg);
+}
+
+void posterior(Eigen::MatrixXd xgt, Eigen::VectorXd &mean, Eigen::MatrixXd &cov, 
+                Eigen::Matrix2d S, Eigen::Matrix2d Si){
     // tested (i.e. same output as python functions)
-    Eigen::MatrixXd K = cell.cov.block(0,0,2,4);
-    cell.mean = cell.mean + K.transpose() * Si * xgt;
-    cell.cov = cell.cov - K.transpose() * Si * K;
+    Eigen::MatrixXd K = cov.block(0,0,2,4);
+    mean = mean + K.transpose() * Si * xgt;
+    cov = cov - K.transpose() * Si * K;
+}
+
+void posterior(Eigen::MatrixXd xgt, MOMAdata &cell, Eigen::Matrix2d S, Eigen::Matrix2d Si){
+    /* updates the (forward) state of the cell */
+    posterior(xgt, cell.mean, cell.cov, S, Si);
 }
 
 /* -------------------------------------------------------------------------- */
 void sc_prediction_forward(const std::vector<double> &params_vec, 
-                    MOMAdata &cell){
+                    MOMAdata &cell, Prediction_arena &arena){
 /* 
 * the params_vec contains paramters in the following (well defined) order:
 * {mean_lambda, gamma_lambda, var_lambda, mean_q, gamma_q, var_q, beta, var_x, var_g, var_dx, var_dg}
@@ -71,42 +258,29 @@ void sc_prediction_forward(const std::vector<double> &params_vec,
         posterior(xg, cell, S, Si); // updates mean/cov
 
         // save current mean/cov before (!) those are set for the next time point
-        cell.mean_forward.push_back(cell.mean);
-        cell.cov_forward.push_back(cell.cov);
+        arena.mean_forward[cell.offset + t] = cell.mean;
+        arena.cov_forward[cell.offset + t] = cell.cov;
 
         // next time point:
         if (t<cell.time.size()-1) {
+            if (arena.smoother){
+                arena.cov_cross[cell.offset + t] = cell.cov * mean_jacobian(cell.mean, cell.cov, 
+                        cell.time(t+1)-cell.time(t) , params_vec[0], 
+                        params_vec[1], params_vec[2], params_vec[3], 
+                        params_vec[4], params_vec[5], params_vec[6]).transpose();
+            }
             mean_cov_model(cell, cell.time(t+1)-cell.time(t) , params_vec[0], 
                         params_vec[1], params_vec[2], params_vec[3], 
                         params_vec[4], params_vec[5], params_vec[6]); // updates mean/cov
+            if (arena.smoother){
+                arena.mean_predicted[cell.offset + t + 1] = cell.mean;
+                arena.cov_predicted[cell.offset + t + 1] = cell.cov;
+            }
         }
     }
 }
 
 
-void prediction_forward_recr(const std::vector<double> &params_vec, 
-                    MOMAdata *cell){
-    /*  
-    * Recursive implementation that applies the function sc_prediction_forward to every cell in the genealogy
-    * not meant to be called directly, see wrapper below
-    */
-    if (cell == nullptr)
-        return;
-    sc_prediction_forward(params_vec, *cell);
-    prediction_forward_recr(params_vec, cell->daughter1);
-    prediction_forward_recr(params_vec, cell->daughter2);
-}
-
-void prediction_forward(const std::vector<double> &params_vec, std::vector<MOMAdata> &cells){
-    /* applies prediction to each cell going down the tree starting from all root cells */
-    std::vector<MOMAdata *> p_roots = get_roots(cells);
-
-    for(size_t i=0; i<p_roots.size(); ++i){
-        prediction_forward_recr(params_vec,  p_roots[i]);
-    }
-}
-
-
 /* --------------------------------------------------------------------------
 * --------------------------------------------------------------------------
 * BACKWARD PREDICTION
@@ -114,14 +288,6 @@ void prediction_forward(const std::vector<double> &params_vec, std::vector<MOMAd
 * -------------------------------------------------------------------------- */
 
 
-void multiply_gaussian(Eigen::VectorXd &m1, Eigen::MatrixXd &c1, Eigen::VectorXd m2, Eigen::MatrixXd c2){
-    /* Multiply first gaussian with second one - inplace multiplication */
-    Eigen::MatrixXd new_c1 = (c1.inverse() + c2.inverse()).inverse();
-    m1 = new_c1 * c1.inverse() * m1  +  new_c1 * c2.inverse() * m2;
-    c1 = new_c1;
-}
-
-
 void mean_cov_after_division_r(MOMAdata &cell, double var_dx, double var_dg){
     /*
     * mean and covariance matrix are updated as cell division occurs backward in time
@@ -133,14 +299,14 @@ void mean_cov_after_division_r(MOMAdata &cell, double var_dx, double var_dg){
     D(0,0) = var_dx;
     D(1,1) = var_dg;
 
-    cell.mean = F*cell.daughter1->mean + f;
-    cell.cov = D + F * cell.daughter1->cov * F.transpose();
+    cell.mean_r = F*cell.daughter1->mean_r + f;
+    cell.cov_r = D + F * cell.daughter1->cov_r * F.transpose();
     
     if (cell.daughter2 != nullptr){
-        Eigen::Vector4d mean2 = F*cell.daughter2->mean + f;
-        Eigen::MatrixXd cov2 = D + F * cell.daughter2->cov * F.transpose();
+        Eigen::Vector4d mean2 = F*cell.daughter2->mean_r + f;
+        Eigen::Matrix4d cov2 = D + F * cell.daughter2->cov_r * F.transpose();
 
-        multiply_gaussian(cell.mean, cell.cov, mean2, cov2);
+        multiply_gaussian(cell.mean_r, cell.cov_r, mean2, cov2);
     }
 }
 
@@ -150,56 +316,44 @@ void mean_cov_model_r(MOMAdata &cell,
                     double mq, double gq, 
                     double sq2, double b){
     /* reverses the mean_cov_model function by switching the sign OU process params and beta */
-    mean_cov_model(cell,t,-ml,-gl,sl2,-mq,-gq,sq2,-b);
+    mean_cov_model(cell.mean_r, cell.cov_r,t,-ml,-gl,sl2,-mq,-gq,sq2,-b);
 }
 
-void append_reversed_mean(MOMAdata &cell){
-    /* append the "reverse" of the mean 
+Eigen::Vector4d reverse_mean(const Eigen::VectorXd &mean){
+    /* returns the "reverse" of the mean 
     mean ->     + + - - 
-    in front of mean_backward variable in cell
     */
-    Eigen::VectorXd temp_mean(4); 
-    temp_mean << cell.mean;
-
-    temp_mean(2) = - cell.mean(2);
-    temp_mean(3) = - cell.mean(3);
-    cell.mean_backward.insert(cell.mean_backward.begin(), temp_mean);
+    Eigen::Vector4d temp_mean = mean;
+    temp_mean(2) = - mean(2);
+    temp_mean(3) = - mean(3);
+    return temp_mean;
 }
 
-void append_reversed_cov(MOMAdata &cell){
-    /* append the "reverse" of the vov 
+Eigen::Matrix4d reverse_cov(const Eigen::MatrixXd &cov){
+    /* returns the "reverse" of the cov
     cov ->  + + - - 
             + + - - 
             - - + + 
             - - + + 
-    in front of cov_backward variable in cell
     */
-    Eigen::MatrixXd temp_cov(4,4);
-    temp_cov << cell.cov;
-    std::vector<std::vector<int>> entries   {{0,2},
-                                            {0,3},
-                                            {1,2},
-                                            {1,3}};
-
-    for(size_t k=0; k<entries.size(); ++k){
-        temp_cov(entries[k][0], entries[k][1]) = - cell.cov(entries[k][0], entries[k][1]);
-        temp_cov(entries[k][1], entries[k][0]) = - cell.cov(entries[k][1], entries[k][0]);
-    }
-    cell.cov_backward.insert(cell.cov_backward.begin(), temp_cov);
+    Eigen::Matrix4d temp_cov = cov;
+    temp_cov.block<2,2>(0,2) *= -1;
+    temp_cov.block<2,2>(2,0) *= -1;
+    return temp_cov;
 }
 
 
 /* -------------------------------------------------------------------------- */
 
 void sc_prediction_backward(const std::vector<double> &params_vec, 
-                    MOMAdata &cell){
+                    MOMAdata &cell, Prediction_arena &arena){
 /* 
 * the params_vec contains paramters in the following (well defined) order:
 * {mean_lambda, gamma_lambda, var_lambda, mean_q, gamma_q, var_q, beta, var_x, var_g, var_dx, var_dg}
 */
     if (cell.is_leaf()){
-        cell.mean = cell.mean_init;
-        cell.cov = cell.cov_init;
+        cell.mean_r = cell.mean_init_r;
+        cell.cov_r = cell.cov_init_r;
     }
     else{
         // mean/cov is calculated from mother cell, does not depend on mean/cov of cell itself
@@ -215,132 +369,686 @@ void sc_prediction_backward(const std::vector<double> &params_vec,
     Eigen::Matrix2d Si;
 
     for (long t=cell.time.size()-1; t>-1; --t ){
-        xg(0) = cell.log_length(t) - cell.mean(0);
-        xg(1) = cell.fp(t)         - cell.mean(1);
+        xg(0) = cell.log_length(t) - cell.mean_r(0);
+        xg(1) = cell.fp(t)         - cell.mean_r(1);
 
-        S = cell.cov.block(0,0,2,2) + D;
+        S = cell.cov_r.block(0,0,2,2) + D;
         Si = S.inverse();
 
-        posterior(xg, cell, S, Si); // updates mean/cov
+        posterior(xg, cell.mean_r, cell.cov_r, S, Si); // updates mean_r/cov_r
 
         // save current mean/cov before (!) those are set for the next time point
-        append_reversed_mean(cell);
-        append_reversed_cov(cell);
+        arena.mean_backward[cell.offset + t] = reverse_mean(cell.mean_r);
+        arena.cov_backward[cell.offset + t] = reverse_cov(cell.cov_r);
 
         // previous time point:
         if (t>0) {
             mean_cov_model_r(cell, cell.time(t)-cell.time(t-1) , params_vec[0], 
                         params_vec[1], params_vec[2], params_vec[3], 
-                        params_vec[4], params_vec[5], params_vec[6]); // updates mean/cov
+                        params_vec[4], params_vec[5], params_vec[6]); // updates mean_r/cov_r
         }
     }
 }
 
 
-void prediction_backward_recr(const std::vector<double> &params_vec, 
-                    MOMAdata *cell){
+/* --------------------------------------------------------------------------
+* --------------------------------------------------------------------------
+* RAUCH-TUNG-STRIEBEL SMOOTHER
+* --------------------------------------------------------------------------
+* -------------------------------------------------------------------------- */
+
+inline void rts_step(const Eigen::Vector4d &m_f, const Eigen::Matrix4d &c_f, const Eigen::Matrix4d &c_cross,
+                    const Eigen::Vector4d &m_p, const Eigen::Matrix4d &c_p,
+                    const Eigen::Vector4d &m_s_next, const Eigen::Matrix4d &c_s_next,
+                    Eigen::Vector4d &m_s, Eigen::Matrix4d &c_s){
+    /*
+    * Smoothed moments of a time point from the forward moments (m_f, c_f) of that time point, the forward
+    * prediction (m_p, c_p) of the next one, the cross-covariance between both and the smoothed moments 
+    * of the next time point, with the gain G = c_cross c_p^-1
+    */
+    Eigen::LDLT<Eigen::Matrix4d> ldlt(c_p);
+    Eigen::Matrix4d G = ldlt.solve(c_cross.transpose()).transpose();
+    m_s = m_f + G * (m_s_next - m_p);
+    c_s = c_f + G * (c_s_next - c_p) * G.transpose();
+    c_s = 0.5 * (c_s + c_s.transpose()).eval();
+}
+
+void fuse_daughters(const Eigen::Vector4d &m_f, const Eigen::Matrix4d &c_f, 
+                    Eigen::Vector4d &m1, Eigen::Matrix4d &c1,
+                    const Eigen::Vector4d &m2, const Eigen::Matrix4d &c2){
+    /*
+    * Both daughters provide independent information on the last time point of the mother cell, 
+    * (m1, c1) and (m2, c2) are the smoothed moments given either subtree, (m_f, c_f) the forward moments
+    * that are part of both. The fused gaussian is m1/c1 * m2/c2 / m_f/c_f (inplace in m1, c1). 
+    * The information form is computed in units of the forward standard deviations, 
+    * as the entries of the covariance matrices differ by many orders of magnitude.
+    */
+    Eigen::Vector4d s = c_f.diagonal().cwiseSqrt();
+    Eigen::Matrix4d S_inv = s.cwiseInverse().asDiagonal();
+
+    Eigen::Matrix4d Lf = (S_inv * c_f * S_inv).inverse();
+    Eigen::Matrix4d L1 = (S_inv * c1 * S_inv).inverse();
+    Eigen::Matrix4d L2 = (S_inv * c2 * S_inv).inverse();
+
+    Eigen::Matrix4d c = (L1 + L2 - Lf).inverse();
+    Eigen::Vector4d m = c * (L1 * S_inv * m1 + L2 * S_inv * m2 - Lf * S_inv * m_f);
+
+    m1 = s.asDiagonal() * m;
+    c1 = s.asDiagonal() * c * s.asDiagonal();
+    c1 = 0.5 * (c1 + c1.transpose()).eval();
+}
+
+void sc_smoother(const std::vector<double> &params_vec, 
+                    MOMAdata &cell, Prediction_arena &arena){
+    /* 
+    * smoothed moments of all time points of a cell, requires the forward prediction and the 
+    * smoothed moments of the daughter cells, stored in mean_prediction/cov_prediction
+    */
+    size_t last = cell.offset + cell.time.size() - 1;
+
+    if (cell.is_leaf()){
+        arena.mean_prediction[last] = arena.mean_forward[last];
+        arena.cov_prediction[last] = arena.cov_forward[last];
+    }
+    else{
+        // forward prediction of the first time point of the daughter cells, see mean_cov_after_division
+        Eigen::Matrix4d F = Eigen::Matrix4d::Identity();
+        F(1,1) = 0.5;
+        Eigen::Vector4d f(-log(2.), 0.0, 0.0, 0.0);
+        Eigen::Matrix4d D = Eigen::Matrix4d::Zero();
+        D(0,0) = params_vec[9];
+        D(1,1) = params_vec[10];
+
+        const Eigen::Vector4d &m_f = arena.mean_forward[last];
+        const Eigen::Matrix4d &c_f = arena.cov_forward[last];
+        Eigen::Vector4d m_p = F * m_f + f;
+        Eigen::Matrix4d c_p = D + F * c_f * F.transpose();
+        Eigen::Matrix4d c_cross = c_f * F.transpose();
+
+        Eigen::Vector4d m1, m2;
+        Eigen::Matrix4d c1, c2;
+        MOMAdata *d1 = cell.daughter1 != nullptr ? cell.daughter1 : cell.daughter2;
+        rts_step(m_f, c_f, c_cross, m_p, c_p, 
+                arena.mean_prediction[d1->offset], arena.cov_prediction[d1->offset], m1, c1);
+
+        if (cell.daughter1 != nullptr && cell.daughter2 != nullptr){
+            MOMAdata *d2 = cell.daughter2;
+            rts_step(m_f, c_f, c_cross, m_p, c_p, 
+                    arena.mean_prediction[d2->offset], arena.cov_prediction[d2->offset], m2, c2);
+            fuse_daughters(m_f, c_f, m1, c1, m2, c2);
+        }
+        arena.mean_prediction[last] = m1;
+        arena.cov_prediction[last] = c1;
+    }
+
+    for (size_t j=last; j>cell.offset; --j){
+        rts_step(arena.mean_forward[j-1], arena.cov_forward[j-1], arena.cov_cross[j-1], 
+                arena.mean_predicted[j], arena.cov_predicted[j],
+                arena.mean_prediction[j], arena.cov_prediction[j],
+                arena.mean_prediction[j-1], arena.cov_prediction[j-1]);
+    }
+}
+
+/* --------------------------------------------------------------------------
+* --------------------------------------------------------------------------
+* SCHEDULING
+* --------------------------------------------------------------------------
+* -------------------------------------------------------------------------- */
+
+void smoother_task(const std::vector<double> &params_vec, 
+                    MOMAdata *cell, Prediction_arena &arena){
+    /* post-order scheduling as in prediction_backward_task */
+    while (cell != nullptr){
+        sc_smoother(params_vec, *cell, arena);
+        MOMAdata *parent = cell->parent;
+        bool parent_ready = parent != nullptr && parent->needs_backward && arena.daughter_done(*parent);
+        arena.cell_done();
+        if (!parent_ready)
+            return; // the other daughter continues with the parent
+        cell = parent;
+    }
+}
+
+void pass_finished(const std::vector<double> &params_vec, 
+                    MOMAdata &cell, Prediction_arena &arena){
+    /* 
+    * bookkeeping after the forward or backward prediction of a cell: the direction that finishes 
+    * the cell last combines both, with the smoother the leafs start the smoothing of the lineage.
+    * Cells that are only needed in one direction (ancestors or descendants of selected cells) are not combined
+    */
+    if (arena.smoother){
+        if (!cell.needs_backward)
+            arena.cell_done();
+        else if (cell.is_leaf())
+            smoother_task(params_vec, &cell, arena);
+    }
+    else if (arena.pass_done(cell)){
+        if (arena.combine && cell.needs_forward && cell.needs_backward)
+            combine_predictions(cell, arena);
+        arena.cell_done();
+    }
+}
+
+void prediction_forward_task(const std::vector<double> &params_vec, 
+                    MOMAdata *cell, Prediction_arena &arena, Thread_pool &pool){
     /*  
-    * Recursive implementation that applies the function sc_prediction_backward to every cell in the genealogy
-    * not meant to be called directly, see wrapper below
+    * Runs the forward prediction down the lineage starting at cell, the second daughter 
+    * of each cell is handed to the pool, the first one continues on the current thread
     */
-    if (cell == nullptr)
-        return;
-    prediction_backward_recr(params_vec, cell->daughter1);
-    prediction_backward_recr(params_vec, cell->daughter2);
-    sc_prediction_backward(params_vec, *cell);
+    while (cell != nullptr){
+        sc_prediction_forward(params_vec, *cell, arena);
+        MOMAdata *daughter1 = cell->daughter1 != nullptr && cell->daughter1->needs_forward ? cell->daughter1 : nullptr;
+        MOMAdata *daughter2 = cell->daughter2 != nullptr && cell->daughter2->needs_forward ? cell->daughter2 : nullptr;
+        if (daughter2 != nullptr)
+            pool.submit([&params_vec, daughter2, &arena, &pool]{ 
+                prediction_forward_task(params_vec, daughter2, arena, pool); });
+        pass_finished(params_vec, *cell, arena);
+        cell = daughter1;
+    }
 }
 
-void prediction_backward(const std::vector<double> &params_vec, std::vector<MOMAdata> &cells){
-    std::vector<MOMAdata *> p_roots = get_roots(cells);
+void prediction_backward_task(const std::vector<double> &params_vec, 
+                    MOMAdata *cell, Prediction_arena &arena){
+    /*  
+    * Post-order scheduling: runs the backward prediction of cell and continues with the parent
+    * on the current thread as soon as both daughters of the parent are done
+    */
+    while (cell != nullptr){
+        sc_prediction_backward(params_vec, *cell, arena);
+        MOMAdata *parent = cell->parent;
+        bool parent_ready = parent != nullptr && parent->needs_backward && arena.daughter_done(*parent);
+        pass_finished(params_vec, *cell, arena);
+        if (!parent_ready)
+            return; // the other daughter continues with the parent
+        cell = parent;
+    }
+}
 
-    for(size_t i=0; i<p_roots.size(); ++i){
-        prediction_backward_recr(params_vec,  p_roots[i]);
+void prediction_submit(const std::vector<double> &params_vec, 
+                    Prediction_arena &arena, Thread_pool &pool){
+    /* 
+    * submits the prediction of all cells in the arena to the pool: forward starting from the root cells, 
+    * backward from the leaf cells, the arena calls on_done once all cells are complete
+    */
+    for(size_t i=0; i<arena.cells.size(); ++i){
+        MOMAdata *cell = arena.cells[i];
+        if (arena.forward && cell->needs_forward && cell->is_root())
+            pool.submit([&params_vec, cell, &arena, &pool]{ 
+                prediction_forward_task(params_vec, cell, arena, pool); });
+        if (arena.backward && cell->needs_backward && cell->is_leaf())
+            pool.submit([&params_vec, cell, &arena]{ 
+                prediction_backward_task(params_vec, cell, arena); });
     }
 }
 
+/* --------------------------------------------------------------------------
+* SELECTION
+* -------------------------------------------------------------------------- */
+
+bool select_subtree(MOMAdata *cell, bool ancestor_selected, bool forward_descendants){
+    /* 
+    * sets the directions needed for the selected cells of the subtree of cell, 
+    * returns true if the subtree contains a selected cell
+    */
+    if (cell == nullptr)
+        return false;
+    cell->needs_backward = cell->selected || ancestor_selected;
+    bool contains_selected = select_subtree(cell->daughter1, cell->needs_backward, forward_descendants);
+    contains_selected = select_subtree(cell->daughter2, cell->needs_backward, forward_descendants) || contains_selected;
+    cell->needs_forward = cell->selected || contains_selected || (forward_descendants && cell->needs_backward);
+    return cell->selected || contains_selected;
+}
 
-void combine_predictions(std::vector<MOMAdata> &cells){
-    /* combines foward and backward predictions by multiplying the gaussians of those predictions */
-    Eigen::VectorXd temp_mean(4); 
-    Eigen::MatrixXd temp_cov(4,4); 
+size_t select_cells(std::vector<MOMAdata> &cells, std::vector<std::string> cell_ids, 
+                    std::vector<std::string> lineage_ids, bool forward_descendants){
+    /*
+    * Restricts the prediction to the given cells and to all cells of the lineages of the given cells.
+    * The forward prediction of a selected cell needs its ancestors, the backward prediction its descendants,
+    * thus only those are predicted in the respective direction, unless forward_descendants is set
+    * (for the smoother that runs on the forward prediction of the descendants). Returns the number of selected cells
+    */
+    std::unordered_map<std::string, MOMAdata*> by_id;
+    for(size_t i=0; i<cells.size(); ++i){
+        by_id[cells[i].cell_id] = &cells[i];
+        cells[i].selected = false;
+        cells[i].needs_forward = false;
+        cells[i].needs_backward = false;
+    }
 
-    for(size_t i=0; i<cells.size();++i){
-        for (size_t j=0; j<cells[i].time.size();++j ){
-            temp_mean << cells[i].mean_forward[j];
-            temp_cov << cells[i].cov_forward[j];
+    std::vector<MOMAdata*> roots;
+    for(size_t i=0; i<cell_ids.size() + lineage_ids.size(); ++i){
+        bool lineage = i >= cell_ids.size();
+        std::string id = lineage ? lineage_ids[i - cell_ids.size()] : cell_ids[i];
+        if (!by_id.count(id)){
+            std::cout << "Cell " << id << " not found, it is ignored\n";
+            continue;
+        }
+        MOMAdata *root = by_id[id];
+        while (!root->is_root())
+            root = root->parent;
+        roots.push_back(root);
 
-            multiply_gaussian(temp_mean, temp_cov, 
-                                cells[i].mean_backward[j], cells[i].cov_backward[j]);
-            cells[i].mean_prediction.push_back(temp_mean);
-            cells[i].cov_prediction.push_back(temp_cov);
+        if (!lineage){
+            by_id[id]->selected = true;
+            continue;
         }
+        std::vector<MOMAdata*> stack = {root};
+        while (stack.size()){
+            MOMAdata *cell = stack.back();
+            stack.pop_back();
+            cell->selected = true;
+            if (cell->daughter1 != nullptr)
+                stack.push_back(cell->daughter1);
+            if (cell->daughter2 != nullptr)
+                stack.push_back(cell->daughter2);
+        }
+    }
+
+    for(size_t i=0; i<roots.size(); ++i){
+        select_subtree(roots[i], false, forward_descendants);
+    }
+    size_t n_selected = 0;
+    for(size_t i=0; i<cells.size(); ++i){
+        n_selected += cells[i].selected;
     }
+    return n_selected;
 }
 
 /* --------------------------------------------------------------------------
 * OUTPUT
 * -------------------------------------------------------------------------- */
-std::string outfile_name_prediction(std::map<std::string, std::string> arguments, std::string suffix=""){
+std::string outfile_name_prediction(std::map<std::string, std::string> arguments, std::string suffix="", 
+                                    std::string extension=".csv"){
     std::string outfile = out_dir(arguments);
     outfile += file_base(arguments["infile"]) + "_prediction" + suffix;
-    return outfile + ".csv";
+    return outfile + extension;
 }
 
 
-void output_upper_triangle(std::ofstream &file, Eigen::MatrixXd m){
-    /* Comma seperated output of upper triangle of 4x4 Eigen::matrix*/
-    std::vector<std::vector<int>> upper_triangle {{0,0}, {0,1}, {0,2}, {0,3},
-                                                         {1,1}, {1,2}, {1,3},
-                                                                {2,2}, {2,3},
-                                                                       {3,3}};
-                                                                       
-    for (size_t k=0; k<upper_triangle.size(); ++k){
-        if (k>0)
-            file << ",";
-        file << m(upper_triangle[k][0], upper_triangle[k][1]);
+class Prediction_columns{
+    /*
+    * Columns of the prediction that are written: mean_<a>, sd_<a> (standard deviation) and cov_<ab> 
+    * for a, b in x, g, l, q, by default all means and the upper triangle of the covariance matrix.
+    * Only every k-th time point of each cell is written (starting with the first), by default all
+    */
+public:
+    std::vector<std::string> names = {"mean_x", "mean_g", "mean_l", "mean_q",
+                                      "cov_xx", "cov_xg", "cov_xl", "cov_xq",
+                                                "cov_gg", "cov_gl", "cov_gq",
+                                                          "cov_ll", "cov_lq",
+                                                                    "cov_qq"};
+    size_t every = 1;
+
+    Prediction_columns(){
+        parse_names();
     }
-}
 
-void output_vector(std::ofstream &file, Eigen::VectorXd v){
-    /* Comma seperated output of Eigen::vector */
-    for (size_t k=0; k<v.size(); ++k){
-        if (k>0)
-            file << ",";
-        file << v(k);
+    bool parse(std::string columns){
+        /* sets the columns from a comma separated list, returns false if a column is unknown */
+        names = split_string_at(columns, ",");
+        return parse_names();
+    }
+
+    bool full() const{
+        /* true if all means and covariances are written (in the default order) */
+        return names == Prediction_columns().names;
     }
-}
 
+    size_t rows(size_t n_points) const{
+        /* number of rows written for a cell with n_points time points */
+        return (n_points + every - 1) / every;
+    }
+
+    double value(size_t col, const Eigen::Vector4d &mean, const Eigen::Matrix4d &cov) const{
+        const Column &c = columns[col];
+        if (c.type == 'm')
+            return mean(c.i);
+        if (c.type == 's')
+            return std::sqrt(cov(c.i, c.i));
+        return cov(c.i, c.j);
+    }
+
+private:
+    struct Column{
+        char type;  // m(ean), s(d) or c(ov)
+        int i;
+        int j;
+    };
+    std::vector<Column> columns;
+
+    bool parse_names(){
+        const std::string quantities = "xglq";
+        columns.clear();
+        for (size_t k=0; k<names.size(); ++k){
+            const std::string &name = names[k];
+            Column c;
+            size_t n_idx = 0;
+            if (name.rfind("mean_", 0) == 0){
+                c.type = 'm';
+                n_idx = 1;
+            } else if (name.rfind("sd_", 0) == 0){
+                c.type = 's';
+                n_idx = 1;
+            } else if (name.rfind("cov_", 0) == 0){
+                c.type = 'c';
+                n_idx = 2;
+            }
+            std::string idx = name.substr(name.find('_') + 1);
+            if (n_idx == 0 || idx.size() != n_idx || quantities.find(idx[0]) == std::string::npos 
+                    || quantities.find(idx.back()) == std::string::npos){
+                std::cout << "Unknown prediction column " << name 
+                          << ", use mean_<a>, sd_<a> or cov_<ab> with a, b in x, g, l, q" << std::endl;
+                return false;
+            }
+            c.i = quantities.find(idx[0]);
+            c.j = quantities.find(idx.back());
+            columns.push_back(c);
+        }
+        return names.size() > 0;
+    }
+};
 
-void write_pretictions_to_file(const std::vector<MOMAdata> &cells, std::string outfile, 
-                                Parameter_set& params, std::string direction="n"){        
+
+void write_prediction_header(std::string outfile, Parameter_set& params, 
+                            const Prediction_columns &columns=Prediction_columns()){
+    /* parameters and column names of a prediction file */
     params.to_csv(outfile);
 
     std::ofstream file(outfile, std::ios_base::app);
-    file << "\ncell_id,time,log_length,fp,";
-    file    << "mean_x,mean_g,mean_l,mean_q,"
-            <<   "cov_xx,cov_xg,cov_xl,cov_xq," 
-                     << "cov_gg,cov_gl,cov_gq,"
-                            << "cov_ll,cov_lq,"
-                                   << "cov_qq\n";
-    for(size_t i=0; i<cells.size();++i){
-        for (size_t j=0; j<cells[i].mean_forward.size();++j ){
-            file << cells[i].cell_id << "," << cells[i].time[j] << "," << cells[i].log_length[j] << "," << cells[i].fp[j] << ",";
-            if(direction=="f"){
-                output_vector(file, cells[i].mean_forward[j]);
-                file << ",";  
-                output_upper_triangle(file, cells[i].cov_forward[j]);
-            } else if (direction=="b"){
-                output_vector(file, cells[i].mean_backward[j]);
-                file << ",";  
-                output_upper_triangle(file, cells[i].cov_backward[j]);
-            } else{
-                output_vector(file, cells[i].mean_prediction[j]);
-                file << ",";  
-                output_upper_triangle(file, cells[i].cov_prediction[j]);
-            }
+    file << "\ncell_id,time,log_length,fp";
+    for (size_t k=0; k<columns.names.size(); ++k)
+        file << "," << columns.names[k];
+    file << "\n";
+}
+
+void write_prediction_rows(std::ofstream &file, const Prediction_arena &arena, char direction, 
+                            const Prediction_columns &columns=Prediction_columns()){
+    /* appends the forward ('f'), backward ('b') or combined ('c') prediction of all cells of the arena */
+    const std::vector<Eigen::Vector4d> &mean = direction=='f' ? arena.mean_forward : 
+                                                (direction=='b' ? arena.mean_backward : arena.mean_prediction);
+    const std::vector<Eigen::Matrix4d> &cov = direction=='f' ? arena.cov_forward : 
+                                                (direction=='b' ? arena.cov_backward : arena.cov_prediction);
+    for(size_t i=0; i<arena.cells.size();++i){
+        const MOMAdata &cell = *arena.cells[i];
+        if (!cell.selected)
+            continue;
+        for (long j=0; j<cell.time.size(); j+=columns.every){
+            size_t k = cell.offset + j;
+            file << cell.cell_id << "," << cell.time_offset + cell.time[j] << "," << cell.log_length[j] << "," << cell.fp[j];
+            for (size_t l=0; l<columns.names.size(); ++l)
+                file << "," << columns.value(l, mean[k], cov[k]);
             file << "\n"; 
         }
     }
+}
+
+
+class Prediction_npz{
+    /*
+    * Prediction file in the numpy .npz format (np.load), containing the arrays
+    *   parameter_names, parameters     final parameters
+    *   cell_id, parent_id              ids of the cells (bytes)
+    *   cell_offset                     rows of cell i are cell_offset[i]:cell_offset[i+1]
+    *   time, log_length, fp            data, one row per time point
+    *   mean                            (n, 4) mean of x, g, l, q
+    *   cov                             (n, 10) upper triangle of the covariance matrix (as in the csv files)
+    *   cell_index                      indices of the cells sorted by cell_id (for the lookup by id)
+    *   lineage_offset                  cells of lineage i are lineage_offset[i]:lineage_offset[i+1]
+    * If only some columns are written (see Prediction_columns), mean and cov are replaced by the array
+    * column_names and one array per column (e.g. sd_l).
+    * The rows are appended lineage by lineage, the index arrays are known beforehand and written by open.
+    * Files can be queried without loading them via Prediction_store
+    */
+public:
+    bool open(std::string outfile, Parameter_set &params, const std::vector<std::vector<MOMAdata*>> &lineages, 
+                const Prediction_columns &prediction_columns=Prediction_columns()){
+        if (!npz.open(outfile))
+            return false;
+        columns = prediction_columns;
+        size_t n_cells = 0, n_points = 0, id_len = 1, name_len = 1;
+        for (size_t i=0; i<lineages.size(); ++i){
+            for (size_t j=0; j<lineages[i].size(); ++j){
+                if (!lineages[i][j]->selected)
+                    continue;
+                ++n_cells;
+                n_points += columns.rows(lineages[i][j]->time.size());
+                id_len = std::max(id_len, std::max(lineages[i][j]->cell_id.size(), lineages[i][j]->parent_id.size()));
+            }
+        }
+        for (size_t i=0; i<params.all.size(); ++i){
+            name_len = std::max(name_len, params.all[i].name.size());
+        }
+        std::string id_descr = "|S" + std::to_string(id_len);
+
+        size_t names_idx = npz.add_array("parameter_names", "|S" + std::to_string(name_len), {params.all.size()}, name_len);
+        size_t params_idx = npz.add_array("parameters", "<f8", {params.all.size()}, 8);
+        cell_id = npz.add_array("cell_id", id_descr, {n_cells}, id_len);
+        parent_id = npz.add_array("parent_id", id_descr, {n_cells}, id_len);
+        cell_offset = npz.add_array("cell_offset", "<i8", {n_cells + 1}, 8);
+        time = npz.add_array("time", "<f8", {n_points}, 8);
+        log_length = npz.add_array("log_length", "<f8", {n_points}, 8);
+        fp = npz.add_array("fp", "<f8", {n_points}, 8);
+        if (columns.full()){
+            mean = npz.add_array("mean", "<f8", {n_points, 4}, 8);
+            cov = npz.add_array("cov", "<f8", {n_points, 10}, 8);
+        } else {
+            size_t column_len = 1;
+            for (size_t i=0; i<columns.names.size(); ++i)
+                column_len = std::max(column_len, columns.names[i].size());
+            size_t column_names_idx = npz.add_array("column_names", "|S" + std::to_string(column_len), {columns.names.size()}, column_len);
+            std::string column_names;
+            for (size_t i=0; i<columns.names.size(); ++i){
+                column_names += fixed_width(columns.names[i], column_len);
+                column_arrays.push_back(npz.add_array(columns.names[i], "<f8", {n_points}, 8));
+            }
+            npz.append(column_names_idx, column_names);
+        }
+        size_t index_idx = npz.add_array("cell_index", "<i8", {n_cells}, 8);
+        size_t lineage_idx = npz.add_array("lineage_offset", "<i8", {lineages.size() + 1}, 8);
+        id_width = id_len;
+
+        /* cell indices in the order of the file, sorted by the (zero padded) cell ids */
+        std::vector<std::string> ids;
+        std::string lineage_offsets;
+        append_le(lineage_offsets, 0, 8);
+        for (size_t i=0; i<lineages.size(); ++i){
+            for (size_t j=0; j<lineages[i].size(); ++j)
+                if (lineages[i][j]->selected)
+                    ids.push_back(fixed_width(lineages[i][j]->cell_id, id_len));
+            append_le(lineage_offsets, ids.size(), 8);
+        }
+        std::vector<size_t> order(ids.size());
+        for (size_t i=0; i<order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&ids](size_t a, size_t b){ return ids[a] < ids[b]; });
+        std::string index;
+        for (size_t i=0; i<order.size(); ++i)
+            append_le(index, order[i], 8);
+        npz.append(index_idx, index);
+        npz.append(lineage_idx, lineage_offsets);
+
+        std::string names, values;
+        std::vector<double> params_vec = params.get_final();
+        for (size_t i=0; i<params.all.size(); ++i){
+            names += fixed_width(params.all[i].name, name_len);
+            append_le(values, params_vec[i]);
+        }
+        npz.append(names_idx, names);
+        npz.append(params_idx, values);
+        return true;
+    }
+
+    void append(const Prediction_arena &arena, char direction){
+        /* appends the forward ('f'), backward ('b') or combined ('c') prediction of all cells of the arena */
+        const std::vector<Eigen::Vector4d> &m = direction=='f' ? arena.mean_forward : 
+                                                (direction=='b' ? arena.mean_backward : arena.mean_prediction);
+        const std::vector<Eigen::Matrix4d> &c = direction=='f' ? arena.cov_forward : 
+                                                (direction=='b' ? arena.cov_backward : arena.cov_prediction);
+        std::string ids, parent_ids, offsets, t, x, g, m_buf, c_buf;
+        std::vector<std::string> column_bufs(column_arrays.size());
+        for(size_t i=0; i<arena.cells.size();++i){
+            const MOMAdata &cell = *arena.cells[i];
+            if (!cell.selected)
+                continue;
+            ids += fixed_width(cell.cell_id, id_width);
+            parent_ids += fixed_width(cell.parent_id, id_width);
+            append_le(offsets, n_rows, 8);
+            n_rows += columns.rows(cell.time.size());
+            for (long j=0; j<cell.time.size(); j+=columns.every){
+                size_t k = cell.offset + j;
+                append_le(t, cell.time_offset + cell.time[j]);
+                append_le(x, (double) cell.log_length[j]);
+                append_le(g, (double) cell.fp[j]);
+                if (!column_arrays.empty()){
+                    for (size_t l=0; l<column_arrays.size(); ++l)
+                        append_le(column_bufs[l], columns.value(l, m[k], c[k]));
+                    continue;
+                }
+                for (int l=0; l<4; ++l)
+                    append_le(m_buf, m[k](l));
+                for (int l=0; l<4; ++l)
+                    for (int n=l; n<4; ++n)
+                        append_le(c_buf, c[k](l, n));
+            }
+        }
+        npz.append(cell_id, ids);
+        npz.append(parent_id, parent_ids);
+        npz.append(cell_offset, offsets);
+        npz.append(time, t);
+        npz.append(log_length, x);
+        npz.append(fp, g);
+        if (column_arrays.empty()){
+            npz.append(mean, m_buf);
+            npz.append(cov, c_buf);
+        }
+        for (size_t l=0; l<column_arrays.size(); ++l)
+            npz.append(column_arrays[l], column_bufs[l]);
+    }
+
+    bool close(){
+        std::string offsets;
+        append_le(offsets, n_rows, 8);
+        npz.append(cell_offset, offsets);
+        return npz.close();
+    }
 
-    file.close();
-}
\ No newline at end of file
+private:
+    Npz_writer npz;
+    size_t cell_id, parent_id, cell_offset, time, log_length, fp, mean, cov;
+    // arrays of the single columns, empty if all means and covariances are written
+    std::vector<size_t> column_arrays;
+    Prediction_columns columns;
+    size_t id_width = 1;
+    size_t n_rows = 0;
+
+    std::string fixed_width(std::string s, size_t width){
+        /* string padded with zero bytes as in numpy bytes arrays */
+        s.resize(width, '\0');
+        return s;
+    }
+};
+
+
+class Lineage_prediction{
+    /*
+    * Streaming prediction of all lineages (cell trees starting at a root cell). Each lineage has its own
+    * Prediction_arena and the lineages run concurrently on the pool, at most `window` lineages are held 
+    * in memory at once. A finished lineage is written to all requested outputs (in the order of the 
+    * root cells) and freed right away, such that the memory is bounded by the largest lineages 
+    * rather than by the whole data set
+    */
+public:
+    Lineage_prediction(const std::vector<double> &params, std::vector<MOMAdata> &cells, 
+                        std::string outputs, bool rts) : params_vec(params), outputs(outputs), rts(rts){
+        /* groups the cells by lineage, within a lineage the cells keep the order of the input */
+        std::vector<MOMAdata *> p_roots = get_roots(cells);
+        std::unordered_map<const MOMAdata*, size_t> root_idx;
+        for(size_t i=0; i<p_roots.size(); ++i){
+            root_idx[p_roots[i]] = i;
+        }
+        lineages.resize(p_roots.size());
+        for(size_t i=0; i<cells.size(); ++i){
+            MOMAdata *root = &cells[i];
+            while (!root->is_root())
+                root = root->parent;
+            lineages[root_idx[root]].push_back(&cells[i]);
+        }
+        /* lineages without selected cells (see select_cells) are not predicted */
+        lineages.erase(std::remove_if(lineages.begin(), lineages.end(), [](const std::vector<MOMAdata*> &lineage){ 
+                            return std::none_of(lineage.begin(), lineage.end(), [](const MOMAdata *cell){ return cell->selected; }); }), 
+                        lineages.end());
+        arenas.resize(lineages.size());
+        finished.resize(lineages.size(), false);
+    }
+
+    void run(const std::map<char, std::string> &outfiles, Parameter_set &params, 
+            Thread_pool &pool, size_t max_lineages, std::string format="csv", 
+            const Prediction_columns &prediction_columns=Prediction_columns()){
+        window = std::max(max_lineages, (size_t) 1);
+        columns = prediction_columns;
+        for (auto it=outfiles.begin(); it!=outfiles.end(); ++it){
+            if (format == "npz"){
+                if (!npz_files[it->first].open(it->second, params, lineages, columns))
+                    return;
+            } else {
+                write_prediction_header(it->second, params, columns);
+                files[it->first].open(it->second, std::ios_base::app);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m);
+            while (n_launched < lineages.size() && n_launched < window)
+                launch(n_launched++, pool);
+        }
+        pool.wait();
+        for (auto it=files.begin(); it!=files.end(); ++it){
+            it->second.close();
+        }
+        for (auto it=npz_files.begin(); it!=npz_files.end(); ++it){
+            if (!it->second.close())
+                std::cerr << "Error: writing " << outfiles.at(it->first) << " failed" << std::endl;
+        }
+    }
+
+private:
+    const std::vector<double> &params_vec;
+    std::string outputs;
+    bool rts;
+
+    std::vector<std::vector<MOMAdata*>> lineages;
+    std::vector<std::unique_ptr<Prediction_arena>> arenas;
+    std::vector<bool> finished;
+    std::map<char, std::ofstream> files;
+    std::map<char, Prediction_npz> npz_files;
+    Prediction_columns columns;
+
+    std::mutex m;
+    size_t window = 1;
+    size_t n_launched = 0;
+    size_t n_written = 0;
+
+    void launch(size_t i, Thread_pool &pool){
+        arenas[i].reset(new Prediction_arena());
+        arenas[i]->allocate(lineages[i], outputs, rts);
+        arenas[i]->on_done = [this, i, &pool]{ lineage_done(i, pool); };
+        prediction_submit(params_vec, *arenas[i], pool);
+    }
+
+    void lineage_done(size_t i, Thread_pool &pool){
+        /* writes all finished lineages that are next in order, frees them and launches new ones */
+        std::lock_guard<std::mutex> lock(m);
+        finished[i] = true;
+        while (n_written < lineages.size() && finished[n_written]){
+            for (auto it=files.begin(); it!=files.end(); ++it){
+                write_prediction_rows(it->second, *arenas[n_written], it->first, columns);
+            }
+            for (auto it=npz_files.begin(); it!=npz_files.end(); ++it){
+                it->second.append(*arenas[n_written], it->first);
+            }
+            arenas[n_written].reset();
+            ++n_written;
+        }
+        while (n_launched < lineages.size() && n_launched < n_written + window)
+            launch(n_launched++, pool);
+    }
+};
@@ -220,14 +220,85 @@ void test_prediction(){
                                             5000.0,
                                             0.001,
                                             5000.0};
-        sc_prediction_forward(params_vec, cell);
-        for (size_t i =0; i<cell.mean_forward.size();++i){
-          std::cout << cell.mean_forward[i]; 
+        Prediction_arena arena;
+        arena.allocate({&cell}, "f");
+        sc_prediction_forward(params_vec, cell, arena);
+        for (long i =0; i<cell.time.size();++i){
+          std::cout << arena.mean_forward[i]; 
 
         }
         std::cout << cell;
 }
 
+void test_rts_smoother(std::vector<MOMAdata> &cells, const std::vector<double> &params_vec){
+    /*
+    * Compares the Rauch-Tung-Striebel smoother to the combined forward/backward prediction:
+    * for each of the 4 mean quantities the mean and max deviation in units of the 
+    * standard deviation of the combined prediction and the mean ratio of the variances
+    */
+    Thread_pool pool(default_threads());
+
+    Prediction_arena combined;
+    combined.allocate(cells);
+    init_cells(cells, 5);
+    init_cells_r(cells, 5);
+    prediction_submit(params_vec, combined, pool);
+    pool.wait();
+
+    Prediction_arena rts;
+    rts.allocate(cells, "c", true);
+    prediction_submit(params_vec, rts, pool);
+    pool.wait();
+
+    std::vector<std::string> names {"x", "g", "l", "q"};
+    std::cout << "---------- RTS SMOOTHER vs FORWARD/BACKWARD -----------"<< "\n";
+    for (int k=0; k<4; ++k){
+        double dev_sum = 0, dev_max = 0, var_ratio = 0;
+        size_t n = 0;
+        for (size_t j=0; j<combined.mean_prediction.size(); ++j){
+            double sd = sqrt(combined.cov_prediction[j](k,k));
+            double dev = std::abs(rts.mean_prediction[j](k) - combined.mean_prediction[j](k)) / sd;
+            if (std::isnan(dev))
+                continue;
+            dev_sum += dev;
+            dev_max = std::max(dev_max, dev);
+            var_ratio += rts.cov_prediction[j](k,k) / combined.cov_prediction[j](k,k);
+            ++n;
+        }
+        std::cout << names[k] << ": mean deviation " << dev_sum/n << " sd, max deviation " << dev_max 
+                  << " sd, variance ratio (rts/combined) " << var_ratio/n << " (" << n << " data points)\n";
+    }
+}
+
+void test_gaussian_process(){
+    /*
+    * The Gaussian process of the Bayesian optimization interpolates the points it is fitted to 
+    * (mean = value, sd ~ 0) and returns to the mean and sd of the values far from them,
+    * the expected improvement is compared to hand-computed values
+    */
+    std::vector<double> xs {0.1, 0.4, 0.7, 0.9};
+    std::vector<double> ys {3, -1, 2, 0.5};
+    Gaussian_process gp;
+    for (size_t i=0; i<xs.size(); ++i)
+        gp.add(Eigen::VectorXd::Constant(1, xs[i]), ys[i]);
+    gp.fit();
+
+    std::cout << "---------- GAUSSIAN PROCESS -----------"<< "\n";
+    std::cout << "length scale: " << gp.length_scale() << "\n";
+    double mean, sd;
+    for (size_t i=0; i<xs.size(); ++i){
+        gp.predict(Eigen::VectorXd::Constant(1, xs[i]), mean, sd);
+        std::cout << "x=" << xs[i] << ": mean " << mean << " (expected " << ys[i] << "), sd " << sd << " (expected ~0)\n";
+    }
+    gp.predict(Eigen::VectorXd::Constant(1, 10), mean, sd);
+    std::cout << "x=10: mean " << mean << " (expected 1.125), sd " << sd << " (expected 1.51555)\n";
+
+    std::cout << "---------- EXPECTED IMPROVEMENT -----------"<< "\n";
+    std::cout << expected_improvement(0, 1, 0) << " (expected 0.398942)\n";
+    std::cout << expected_improvement(1, 2, 0) << " (expected 0.395593)\n";
+    std::cout << expected_improvement(0, 1, 1) << " (expected 1.08332)\n";
+}
+
 void run_likelihood(CSVconfig config, Parameter_set params, std::string infile){
 
     std::cout << "-> Reading" << "\n";
@@ -0,0 +1,94 @@
+#include <vector>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// ============================================================================= //
+// THREAD POOL
+// ============================================================================= //
+
+int default_threads(){
+    /* number of threads used if not set by the user */
+    int n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+
+class Thread_pool{
+    /*
+    * Fixed number of worker threads that run submitted tasks in the order of submission.
+    * Tasks may submit further tasks (e.g. the next cells of a lineage), wait() returns
+    * once all submitted tasks, including those submitted while waiting, are done
+    */
+public:
+    Thread_pool(int n_threads){
+        for (int i=0; i<std::max(n_threads, 1); ++i)
+            workers.push_back(std::thread(&Thread_pool::work, this));
+    }
+
+    ~Thread_pool(){
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stop = true;
+        }
+        cv_task.notify_all();
+        for (size_t i=0; i<workers.size(); ++i)
+            workers[i].join();
+    }
+
+    size_t size() const{
+        return workers.size();
+    }
+
+    void submit(std::function<void()> task){
+        {
+            std::lock_guard<std::mutex> lock(m);
+            tasks.push_back(std::move(task));
+            ++pending;
+        }
+        cv_task.notify_one();
+    }
+
+    void wait(){
+        std::unique_lock<std::mutex> lock(m);
+        cv_done.wait(lock, [this]{ return pending == 0; });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+
+    std::mutex m;
+    std::condition_variable cv_task;
+    std::condition_variable cv_done;
+    size_t pending = 0; // submitted, but not yet finished tasks
+    bool stop = false;
+
+    void work(){
+        while (true){
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv_task.wait(lock, [this]{ return !tasks.empty() || stop; });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(m);
+                --pending;
+            }
+            cv_done.notify_all();
+        }
+    }
+};
+
+#endif
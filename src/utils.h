@@ -4,6 +4,12 @@
 #include <sstream>  
 #include <map> 
 #include <filesystem>
+#include <algorithm>
+#include <fnmatch.h>
+#include <cstdlib>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
 
 
 #ifndef UTILS_H
@@ -61,6 +67,32 @@ std::string trim(const std::string& str, char trim_char =' '){
     return str.substr(first, (last - first + 1));
 }
 
+bool is_nan(double x){
+    /* like std::isnan, which is optimized away with -ffast-math (assumes that there are no NaN/inf) */
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return (bits & 0x7fffffffffffffff) > 0x7ff0000000000000;
+}
+
+bool is_finite(double x){
+    /* like std::isfinite, but also with -ffast-math */
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return (bits & 0x7ff0000000000000) != 0x7ff0000000000000;
+}
+
+bool parse_number(const std::string &s, double &x){
+    /* converts s to x, returns false if s (apart from surrounding whitespace) is not a number */
+    const char *start = s.c_str();
+    char *end;
+    x = std::strtod(start, &end);
+    if (end == start)
+        return false;
+    while (std::isspace((unsigned char) *end))
+        ++end;
+    return *end == '\0';
+}
+
 template<typename T>
 std::vector<T> arange(T start, T stop, T step = 1) {
     /* numpy like arange */
@@ -71,8 +103,15 @@ std::vector<T> arange(T start, T stop, T step = 1) {
 }
 
 
+std::string strip_trailing_slash(std::string path){
+    while (path.size() > 1 && path.back() == '/')
+        path.pop_back();
+    return path;
+}
+
 std::string default_out_dir(std::string infile){
     /* composes the default out_dir */
+    infile = strip_trailing_slash(infile);
     std::vector<std::string> infile_split, base_split;
     infile_split = split_string_at(infile, "/");
     base_split = split_string_at(infile_split[infile_split.size()-1], ".");
@@ -100,12 +139,60 @@ std::string out_dir(std::map<std::string, std::string> arguments){
 }
 
 
+bool is_stream_input(std::string infile){
+    /* true if the input is read from stdin ("-") or a named pipe */
+    return infile == "-" || std::filesystem::is_fifo(infile);
+}
+
+
 std::string file_base(std::string infile){
-    /* returns the base of the file name (without dir name) */
+    /* returns the base of the file name (without dir name), "stdin" when reading from stdin */
+    if (infile == "-")
+        return "stdin";
+    infile = strip_trailing_slash(infile);
     std::vector<std::string> infile_split, base_split;    
     infile_split = split_string_at(infile, "/");
     base_split = split_string_at(infile_split[infile_split.size()-1], ".");
     return base_split[0];
 }
 
+
+bool is_glob(std::string path){
+    return path.find_first_of("*?[") != std::string::npos;
+}
+
+std::vector<std::string> expand_infiles(std::vector<std::string> values){
+    /* 
+    * expands the values given to the infile flag to a list of files:
+    *   - files (and '-' for stdin) are taken as they are
+    *   - directories are replaced by all files in them containing ".csv" (e.g. .csv, .csv.gz), sorted
+    *   - glob patterns (in the file name only, e.g. "data/pos*.csv") are replaced by the matching files, sorted
+    */
+    std::vector<std::string> infiles;
+    for (size_t i=0; i<values.size(); ++i){
+        std::vector<std::string> matches;
+        if (is_glob(values[i])){
+            std::filesystem::path pattern(values[i]);
+            std::filesystem::path dir = pattern.has_parent_path() ? pattern.parent_path() : ".";
+            if (std::filesystem::is_directory(dir)){
+                for (const auto &entry : std::filesystem::directory_iterator(dir)){
+                    if (!entry.is_directory() && 
+                        fnmatch(pattern.filename().c_str(), entry.path().filename().c_str(), 0) == 0)
+                        matches.push_back(pattern.has_parent_path() ? entry.path().string() : entry.path().filename().string());
+                }
+            }
+        } else if (values[i] != "-" && std::filesystem::is_directory(values[i])){
+            for (const auto &entry : std::filesystem::directory_iterator(values[i])){
+                if (!entry.is_directory() && entry.path().filename().string().find(".csv") != std::string::npos)
+                    matches.push_back(entry.path().string());
+            }
+        } else {
+            matches.push_back(values[i]);
+        }
+        std::sort(matches.begin(), matches.end());
+        infiles.insert(infiles.end(), matches.begin(), matches.end());
+    }
+    return infiles;
+}
+
 #endif 